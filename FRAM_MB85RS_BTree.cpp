@@ -0,0 +1,695 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_BTree.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    B+tree index stored on the MB85RS SPI FRAM series.
+
+    F-RAM layout from startAddr:
+        [0..3]   BTREE_MAGIC
+        [4..7]   address of the root node, 0 for an empty tree
+        [8..11]  number of nodes allocated
+        [12]     height of the tree
+        then nbNodes nodes of BTREE_NODE_SIZE bytes:
+        [0]      BTREE_LEAF or BTREE_INTERNAL
+        [2..3]   number of entries
+        [4..7]   address of the next leaf
+        [8.. ]   entries, key (32-bits) then value (32-bits)
+
+    Internal entries hold the smallest key of their child. When a full node
+    receives a key at its end, as with increasing timestamps, the new key
+    starts a new node and the full one is left as is: appended keys fill
+    the nodes completely and an insertion writes one leaf in most cases.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_BTree.h>
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_BTree()
+///              Constructor, nothing is read or written before begin() or format()
+///     @param   fram, the F-RAM device
+///     @param   startAddr, F-RAM address of the tree
+///     @param   nbNodes, number of BTREE_NODE_SIZE nodes owned by the tree
+**/
+FRAM_MB85RS_BTree::FRAM_MB85RS_BTree(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t nbNodes)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _nbNodes = nbNodes;
+    _root = 0;
+    _nodeCount = 0;
+    _height = 0;
+    _nodeReads = 0;
+
+    memset(_cacheAddr, 0, sizeof(_cacheAddr));
+    _cacheNext = 0;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   format()
+///              Create an empty tree
+///     @return  0: error, the tree does not fit in the chip
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::format()
+{
+    if (!_fits())
+        return false;
+
+    _root = 0;
+    _nodeCount = 0;
+    _height = 0;
+
+    memset(_cacheAddr, 0, sizeof(_cacheAddr));
+
+    return _writeHeader();
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Open an existing tree
+///     @return  0: error, the tree does not fit in the chip or no tree at this address
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::begin()
+{
+    uint8_t header[BTREE_HEADER_SIZE];
+
+    if (!_fits() || !_fram.readArray(_startAddr, header, BTREE_HEADER_SIZE))
+        return false;
+
+    uint32_t magic = (uint32_t)header[0] | ((uint32_t)header[1] << 8)
+                   | ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+
+    if (magic != BTREE_MAGIC)
+        return false;
+
+    _root = (uint32_t)header[4] | ((uint32_t)header[5] << 8)
+          | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+    _nodeCount = (uint32_t)header[8] | ((uint32_t)header[9] << 8)
+               | ((uint32_t)header[10] << 16) | ((uint32_t)header[11] << 24);
+    _height = header[12];
+
+    memset(_cacheAddr, 0, sizeof(_cacheAddr));
+
+    return _nodeCount <= _nbNodes && _height <= BTREE_MAX_HEIGHT;
+}
+
+
+
+/*!
+///     @brief   insert()
+///              Insert a key, after the entries of the same key if any
+///     @param   key, the key (timestamp)
+///     @param   value, the value (address of the record)
+///     @return  0: error, no more node available
+///              1: ok
+///     @note    Costs one leaf read and one leaf write, plus one node write
+///              per level when nodes split
+**/
+boolean FRAM_MB85RS_BTree::insert(uint32_t key, uint32_t value)
+{
+    if (_root == 0)
+    {
+        uint32_t addr = _allocNode();
+        if (addr == 0)
+            return false;
+
+        _node.type = BTREE_LEAF;
+        _node.count = 1;
+        _node.next = 0;
+        _node.keys[0] = key;
+        _node.values[0] = value;
+
+        if (!_writeNode(addr, &_node))
+            return false;
+
+        _root = addr;
+        _height = 1;
+
+        return _writeHeader();
+    }
+
+    uint32_t path[BTREE_MAX_HEIGHT];
+    uint16_t slot[BTREE_MAX_HEIGHT];
+    uint32_t addr = _root;
+    uint8_t level;
+
+    // Descend to the leaf, recording the path for the splits
+    for (level = 0; level + 1 < _height; level++)
+    {
+        if (!_readNode(addr, &_node))
+            return false;
+
+        uint16_t i = _upperBound(&_node, key);
+        if (i == 0)
+        {
+            // New smallest key of the subtree
+            _node.keys[0] = key;
+            if (!_writeNode(addr, &_node))
+                return false;
+            i = 1;
+        }
+
+        path[level] = addr;
+        slot[level] = i - 1;
+        addr = _node.values[i - 1];
+    }
+
+    if (!_readNode(addr, &_node))
+        return false;
+
+    uint32_t newAddr, newKey;
+    if (!_insertEntry(addr, _upperBound(&_node, key), key, value, &newAddr, &newKey))
+        return false;
+
+    // Insert the new nodes in their parents
+    while (newAddr != 0 && level > 0)
+    {
+        level--;
+        if (!_readNode(path[level], &_node))
+            return false;
+
+        uint32_t childAddr = newAddr;
+        if (!_insertEntry(path[level], slot[level] + 1, newKey, childAddr, &newAddr, &newKey))
+            return false;
+    }
+
+    if (newAddr == 0)
+        return true;
+
+    // Root split, the tree grows by one level
+    if (_height >= BTREE_MAX_HEIGHT || !_readNode(_root, &_node))
+        return false;
+
+    uint32_t rootKey = _node.keys[0];
+    uint32_t rootAddr = _allocNode();
+    if (rootAddr == 0)
+        return false;
+
+    _node.type = BTREE_INTERNAL;
+    _node.count = 2;
+    _node.next = 0;
+    _node.keys[0] = rootKey;
+    _node.values[0] = _root;
+    _node.keys[1] = newKey;
+    _node.values[1] = newAddr;
+
+    if (!_writeNode(rootAddr, &_node))
+        return false;
+
+    _root = rootAddr;
+    _height++;
+
+    return _writeHeader();
+}
+
+
+
+/*!
+///     @brief   find()
+///              Point lookup of the first entry of a key
+///     @param   key, the key to look for
+///     @param   value, the value found
+///     @return  0: key not found
+///              1: ok
+///     @note    Internal nodes come from the RAM cache once warm,
+///              a lookup costs one leaf read
+**/
+boolean FRAM_MB85RS_BTree::find(uint32_t key, uint32_t *value)
+{
+    uint16_t index;
+
+    if (!_lowerBound(key, &index) || index >= _node.count || _node.keys[index] != key)
+        return false;
+
+    *value = _node.values[index];
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   range()
+///              Stream the entries with first <= key <= last in key order,
+///              leaves are read one after the other following their chain
+///     @param   first, lowest key
+///     @param   last, highest key
+///     @param   callback, called for each entry, returns 0 to stop
+///     @param   context, passed to the callback
+///     @return  the number of entries passed to the callback
+**/
+uint32_t FRAM_MB85RS_BTree::range(uint32_t first, uint32_t last,
+                                  boolean (*callback)(uint32_t key, uint32_t value, void *context), void *context)
+{
+    uint16_t index;
+    uint32_t n = 0;
+
+    if (first > last || !_lowerBound(first, &index))
+        return 0;
+
+    while (true)
+    {
+        for (; index < _node.count; index++)
+        {
+            if (_node.keys[index] > last)
+                return n;
+
+            n++;
+            if (!callback(_node.keys[index], _node.values[index], context))
+                return n;
+        }
+
+        if (_node.next == 0 || !_readNode(_node.next, &_node))
+            return n;
+
+        index = 0;
+    }
+}
+
+
+
+/*!
+///    @brief   getHeight()
+///    @return  number of levels, leaves included
+**/
+uint8_t FRAM_MB85RS_BTree::getHeight()
+{
+    return _height;
+}
+
+
+
+/*!
+///    @brief   getNodeCount()
+///    @return  number of nodes allocated
+**/
+uint32_t FRAM_MB85RS_BTree::getNodeCount()
+{
+    return _nodeCount;
+}
+
+
+
+/*!
+///    @brief   getNodeReads()
+///    @return  number of nodes read from F-RAM, cache hits excluded
+**/
+uint32_t FRAM_MB85RS_BTree::getNodeReads()
+{
+    return _nodeReads;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _fits()
+///              Check the header and the nodes against the chip, without overflow
+///     @return  0: the tree does not fit
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::_fits()
+{
+    uint32_t maxAddr = _fram.getMaxMemAdr();
+
+    if (_startAddr >= maxAddr || maxAddr - _startAddr < BTREE_HEADER_SIZE)
+        return false;
+
+    return _nbNodes <= (maxAddr - _startAddr - BTREE_HEADER_SIZE) / BTREE_NODE_SIZE;
+}
+
+
+/*!
+///     @brief   _readNode()
+///              Read a node in one burst, internal nodes from the cache
+///     @return  0: error, or not a node
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::_readNode(uint32_t addr, Node *node)
+{
+    for (uint8_t s = 0; s < BTREE_CACHE_NODES; s++)
+        if (_cacheAddr[s] == addr)
+        {
+            memcpy(node, &_cache[s], sizeof(Node));
+            return true;
+        }
+
+    uint8_t raw[BTREE_NODE_SIZE];
+    if (!_fram.readArray(addr, raw, BTREE_NODE_SIZE))
+        return false;
+
+    _nodeReads++;
+
+    node->type = raw[0];
+    node->count = (uint16_t)raw[2] | ((uint16_t)raw[3] << 8);
+    node->next = (uint32_t)raw[4] | ((uint32_t)raw[5] << 8)
+               | ((uint32_t)raw[6] << 16) | ((uint32_t)raw[7] << 24);
+
+    if ((node->type != BTREE_LEAF && node->type != BTREE_INTERNAL) || node->count > BTREE_ORDER)
+        return false;
+
+    for (uint16_t i = 0; i < node->count; i++)
+    {
+        const uint8_t *e = &raw[BTREE_NODE_HEADER + i * 8];
+        node->keys[i] = (uint32_t)e[0] | ((uint32_t)e[1] << 8)
+                      | ((uint32_t)e[2] << 16) | ((uint32_t)e[3] << 24);
+        node->values[i] = (uint32_t)e[4] | ((uint32_t)e[5] << 8)
+                        | ((uint32_t)e[6] << 16) | ((uint32_t)e[7] << 24);
+    }
+
+    if (node->type == BTREE_INTERNAL)
+        _cacheStore(addr, node);
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _writeNode()
+///              Write the used part of a node in one burst,
+///              internal nodes are written through the cache
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::_writeNode(uint32_t addr, Node *node)
+{
+    uint8_t raw[BTREE_NODE_SIZE];
+
+    raw[0] = node->type;
+    raw[1] = 0;
+    raw[2] = node->count & 0xFF;
+    raw[3] = (node->count >> 8) & 0xFF;
+    for (uint8_t b = 0; b < 4; b++)
+        raw[4 + b] = (node->next >> (8 * b)) & 0xFF;
+
+    for (uint16_t i = 0; i < node->count; i++)
+    {
+        uint8_t *e = &raw[BTREE_NODE_HEADER + i * 8];
+        for (uint8_t b = 0; b < 4; b++)
+        {
+            e[b] = (node->keys[i] >> (8 * b)) & 0xFF;
+            e[4 + b] = (node->values[i] >> (8 * b)) & 0xFF;
+        }
+    }
+
+    if (!_fram.writeArray(addr, raw, BTREE_NODE_HEADER + node->count * 8))
+        return false;
+
+    if (node->type == BTREE_INTERNAL)
+        _cacheStore(addr, node);
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _cacheStore()
+///              Keep an internal node in RAM, the root is never evicted
+**/
+void FRAM_MB85RS_BTree::_cacheStore(uint32_t addr, Node *node)
+{
+    uint8_t s;
+
+    for (s = 0; s < BTREE_CACHE_NODES; s++)
+        if (_cacheAddr[s] == addr)
+            break;
+
+    if (s == BTREE_CACHE_NODES)
+    {
+        s = _cacheNext;
+        if (_cacheAddr[s] == _root && BTREE_CACHE_NODES > 1)
+            s = (s + 1) % BTREE_CACHE_NODES;
+        _cacheNext = (s + 1) % BTREE_CACHE_NODES;
+    }
+
+    _cacheAddr[s] = addr;
+    memcpy(&_cache[s], node, sizeof(Node));
+}
+
+
+
+/*!
+///     @brief   _writeHeader()
+///              Write the tree header
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::_writeHeader()
+{
+    uint8_t header[BTREE_HEADER_SIZE];
+
+    for (uint8_t b = 0; b < 4; b++)
+    {
+        header[b] = ((uint32_t)BTREE_MAGIC >> (8 * b)) & 0xFF;
+        header[4 + b] = (_root >> (8 * b)) & 0xFF;
+        header[8 + b] = (_nodeCount >> (8 * b)) & 0xFF;
+    }
+    header[12] = _height;
+
+    return _fram.writeArray(_startAddr, header, BTREE_HEADER_SIZE);
+}
+
+
+
+/*!
+///     @brief   _allocNode()
+///              Take the next free node, the header is written first so
+///              that a power loss leaks the node rather than reusing it
+///     @return  the node address, 0 when the tree is full
+**/
+uint32_t FRAM_MB85RS_BTree::_allocNode()
+{
+    if (_nodeCount >= _nbNodes)
+        return 0;
+
+    uint32_t addr = _startAddr + BTREE_HEADER_SIZE + _nodeCount * BTREE_NODE_SIZE;
+
+    _nodeCount++;
+    if (!_writeHeader())
+    {
+        _nodeCount--;
+        return 0;
+    }
+
+    return addr;
+}
+
+
+
+/*!
+///     @brief   _lowerBound()
+///              Find the first entry with a key not less than key,
+///              the leaf holding it is left in _node
+///     @param   key, the key to look for
+///     @param   index, index of the entry in _node, _node.count if none
+///     @return  0: error, or empty tree
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::_lowerBound(uint32_t key, uint16_t *index)
+{
+    if (_root == 0)
+        return false;
+
+    uint32_t addr = _root;
+
+    for (uint8_t level = 0; level + 1 < _height; level++)
+    {
+        if (!_readNode(addr, &_node))
+            return false;
+
+        // Last child whose smallest key is below key: equal keys may
+        // end the previous child
+        uint16_t i = _firstNotLess(&_node, key);
+        addr = _node.values[i > 0 ? i - 1 : 0];
+    }
+
+    if (!_readNode(addr, &_node))
+        return false;
+
+    *index = _firstNotLess(&_node, key);
+
+    // Entry in the next leaf
+    while (*index == _node.count && _node.next != 0)
+    {
+        if (!_readNode(_node.next, &_node))
+            return false;
+        *index = _firstNotLess(&_node, key);
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _insertEntry()
+///              Insert an entry in the node held by _node, splitting it when full
+///     @param   addr, address of the node
+///     @param   position, index of the new entry
+///     @param   key, value, the entry
+///     @param   newAddr, address of the node created by a split, 0 if none
+///     @param   newKey, smallest key of the new node
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BTree::_insertEntry(uint32_t addr, uint16_t position, uint32_t key, uint32_t value,
+                                        uint32_t *newAddr, uint32_t *newKey)
+{
+    *newAddr = 0;
+
+    if (_node.count < BTREE_ORDER)
+    {
+        for (uint16_t i = _node.count; i > position; i--)
+        {
+            _node.keys[i] = _node.keys[i - 1];
+            _node.values[i] = _node.values[i - 1];
+        }
+        _node.keys[position] = key;
+        _node.values[position] = value;
+        _node.count++;
+
+        return _writeNode(addr, &_node);
+    }
+
+    uint32_t sibling = _allocNode();
+    if (sibling == 0)
+        return false;
+
+    _sibling.type = _node.type;
+
+    if (position == _node.count)
+    {
+        // Appending: the full node stays full, the key starts a new node
+        _sibling.count = 1;
+        _sibling.keys[0] = key;
+        _sibling.values[0] = value;
+    }
+    else
+    {
+        // Even split of the BTREE_ORDER + 1 entries
+        uint16_t total = BTREE_ORDER + 1;
+        uint16_t left = total / 2;
+
+        for (uint16_t j = left; j < total; j++)
+        {
+            uint16_t k = j - left;
+            if (j < position)
+            {
+                _sibling.keys[k] = _node.keys[j];
+                _sibling.values[k] = _node.values[j];
+            }
+            else if (j == position)
+            {
+                _sibling.keys[k] = key;
+                _sibling.values[k] = value;
+            }
+            else
+            {
+                _sibling.keys[k] = _node.keys[j - 1];
+                _sibling.values[k] = _node.values[j - 1];
+            }
+        }
+        _sibling.count = total - left;
+
+        if (position < left)
+        {
+            for (uint16_t i = left - 1; i > position; i--)
+            {
+                _node.keys[i] = _node.keys[i - 1];
+                _node.values[i] = _node.values[i - 1];
+            }
+            _node.keys[position] = key;
+            _node.values[position] = value;
+        }
+        _node.count = left;
+    }
+
+    if (_node.type == BTREE_LEAF)
+    {
+        _sibling.next = _node.next;
+        _node.next = sibling;
+    }
+    else
+        _sibling.next = 0;
+
+    // The new node is written before being linked
+    if (!_writeNode(sibling, &_sibling) || !_writeNode(addr, &_node))
+        return false;
+
+    *newAddr = sibling;
+    *newKey = _sibling.keys[0];
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _upperBound()
+///     @return  index of the first key greater than key, count if none
+**/
+uint16_t FRAM_MB85RS_BTree::_upperBound(Node *node, uint32_t key)
+{
+    uint16_t lo = 0, hi = node->count;
+
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if (node->keys[mid] <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+
+/*!
+///     @brief   _firstNotLess()
+///     @return  index of the first key not less than key, count if none
+**/
+uint16_t FRAM_MB85RS_BTree::_firstNotLess(Node *node, uint32_t key)
+{
+    uint16_t lo = 0, hi = node->count;
+
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if (node->keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
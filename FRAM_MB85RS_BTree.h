@@ -0,0 +1,110 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_BTree.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    B+tree index stored on the MB85RS SPI FRAM series, mapping 32-bits
+    keys (timestamps) to 32-bits values (record addresses).
+    Every node is read or written in one burst, internal nodes are
+    cached in RAM and leaves are chained for range scans.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_BTREE_H__
+#define __FRAM_MB85RS_BTREE_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+// DEFINES
+
+// Size of a node on F-RAM, one burst per node access.
+// With 256 bytes a node holds 31 entries, 3 levels index about 30000 keys.
+#ifndef BTREE_NODE_SIZE
+    #define BTREE_NODE_SIZE 256
+#endif
+
+// Number of internal nodes kept in RAM, BTREE_NODE_SIZE bytes each.
+// Once the upper levels fit in the cache a lookup reads one leaf only.
+// Lower both values on small AVR targets.
+#ifndef BTREE_CACHE_NODES
+    #define BTREE_CACHE_NODES 8
+#endif
+
+#define BTREE_MAX_HEIGHT    8
+#define BTREE_NODE_HEADER   8   // type, reserved, count (16-bits), next leaf (32-bits)
+#define BTREE_ORDER         ((BTREE_NODE_SIZE - BTREE_NODE_HEADER) / 8)  // Entries per node
+
+// Tree header: magic, root address, nodes allocated, height
+#define BTREE_MAGIC         0x45455242 // "BREE"
+#define BTREE_HEADER_SIZE   13
+
+#define BTREE_LEAF          1
+#define BTREE_INTERNAL      2
+
+
+class FRAM_MB85RS_BTree
+{
+ public:
+    FRAM_MB85RS_BTree(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t nbNodes);
+
+    boolean format();
+    boolean begin();
+
+    boolean insert(uint32_t key, uint32_t value);
+    boolean find(uint32_t key, uint32_t *value);
+    uint32_t range(uint32_t first, uint32_t last,
+                   boolean (*callback)(uint32_t key, uint32_t value, void *context), void *context);
+
+    uint8_t  getHeight();
+    uint32_t getNodeCount();
+    uint32_t getNodeReads();
+
+
+ private:
+
+    struct Node
+    {
+        uint8_t     type;                   // BTREE_LEAF or BTREE_INTERNAL
+        uint16_t    count;                  // Entries used
+        uint32_t    next;                   // Next leaf, 0 for the last one
+        uint32_t    keys[BTREE_ORDER];      // Internal: smallest key of the child
+        uint32_t    values[BTREE_ORDER];    // Internal: address of the child
+    };
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // F-RAM address of the tree header
+    uint32_t    _nbNodes;       // Nodes available
+    uint32_t    _root;          // Address of the root node, 0 for an empty tree
+    uint32_t    _nodeCount;     // Nodes allocated
+    uint8_t     _height;        // Levels, leaves included
+    uint32_t    _nodeReads;     // Nodes read from F-RAM
+
+    Node        _node;          // Working nodes
+    Node        _sibling;
+
+    uint32_t    _cacheAddr[BTREE_CACHE_NODES];  // 0 for a free slot
+    Node        _cache[BTREE_CACHE_NODES];
+    uint8_t     _cacheNext;     // Next slot to replace
+
+    boolean     _fits();
+    boolean     _readNode(uint32_t addr, Node *node);
+    boolean     _writeNode(uint32_t addr, Node *node);
+    void        _cacheStore(uint32_t addr, Node *node);
+    boolean     _writeHeader();
+    uint32_t    _allocNode();
+    boolean     _lowerBound(uint32_t key, uint16_t *index);
+    boolean     _insertEntry(uint32_t addr, uint16_t position, uint32_t key, uint32_t value,
+                             uint32_t *newAddr, uint32_t *newKey);
+
+    static uint16_t _upperBound(Node *node, uint32_t key);
+    static uint16_t _firstNotLess(Node *node, uint32_t key);
+};
+
+
+
+#endif
@@ -0,0 +1,418 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Bitmap.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Persistent bitmap over a range of the MB85RS SPI FRAM series.
+
+    A single bit update reads its byte and writes it back only when it
+    changes. Ranges write their two edge bytes masked and the bytes in
+    between with one fill burst. Counting and searching stream the bitmap
+    in one READ through readStream() and work on 32-bits words, a search
+    ends the READ on its first match.
+
+    A single bit update costs a READ plus a WRITE (4 transactions with
+    WREN and WRDI), it is not the fast path: to update many bits, build
+    them in RAM and use readBytes() / writeBytes(), one burst each.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_Bitmap.h>
+
+#define BITMAP_COUNT        0
+#define BITMAP_FIRST_SET    1
+#define BITMAP_FIRST_CLEAR  2
+
+
+// _scan() state. Chunks of the stream are multiples of 4 bytes but the
+// last one, so a word never straddles two chunks.
+struct FramBitmapScanState
+{
+    uint32_t    bit;            // Index of the first bit of the next word
+    uint32_t    firstBit;       // Bits [firstBit, endBit) are scanned
+    uint32_t    endBit;
+    uint8_t     mode;           // BITMAP_COUNT, BITMAP_FIRST_SET or BITMAP_FIRST_CLEAR
+    uint32_t    total;          // Bits set so far
+    boolean     found;          // A find matched, at result
+    uint32_t    result;
+};
+
+static boolean framBitmapConsumer(const uint8_t *data, size_t length, void *context)
+{
+    FramBitmapScanState *st = (FramBitmapScanState *)context;
+
+    for (size_t i = 0; i < length; i += 4, st->bit += 32)
+    {
+        // The last word is padded, the padding is masked out
+        uint32_t word = 0;
+        for (size_t k = 0; k < 4 && i + k < length; k++)
+            word |= (uint32_t)data[i + k] << (8 * k);
+
+        // Bits of the word within [firstBit, endBit)
+        uint32_t lo = (st->firstBit > st->bit) ? st->firstBit - st->bit : 0;
+        uint32_t hi = (st->endBit < st->bit + 32) ? st->endBit - st->bit : 32;
+        uint32_t mask = ((hi == 32) ? 0xFFFFFFFF : ((1UL << hi) - 1)) & ~((1UL << lo) - 1);
+
+        if (st->mode == BITMAP_COUNT)
+            st->total += __builtin_popcountl((unsigned long)(word & mask));
+        else
+        {
+            uint32_t bits = ((st->mode == BITMAP_FIRST_SET) ? word : ~word) & mask;
+            if (bits != 0)
+            {
+                st->result = st->bit + __builtin_ctzl((unsigned long)bits);
+                st->found = true;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_Bitmap()
+///              Constructor
+///     @param   fram, the F-RAM device
+///     @param   startAddr, F-RAM address of the first byte of the bitmap
+///     @param   nbBits, number of bits, (nbBits + 7) / 8 bytes are used
+**/
+FRAM_MB85RS_Bitmap::FRAM_MB85RS_Bitmap(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t nbBits)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _nbBits = nbBits;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   test()
+///              Read one bit
+///     @param   bit, index of the bit
+///     @param   state, the bit value
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::test(uint32_t bit, boolean *state)
+{
+    uint8_t value;
+
+    if (bit >= _nbBits || !_fram.read(_startAddr + (bit >> 3), &value))
+        return false;
+
+    *state = (value >> (bit & 7)) & 1;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   set()
+///              Set one bit
+///     @param   bit, index of the bit
+///     @return  0: error
+///              1: ok
+///     @note    A READ and a WRITE per call, the write is skipped when the
+///              bit does not change. Not the fast path for many bits, see
+///              writeBytes().
+**/
+boolean FRAM_MB85RS_Bitmap::set(uint32_t bit)
+{
+    return _writeBit(bit, true);
+}
+
+
+
+/*!
+///     @brief   clear()
+///              Clear one bit
+///     @param   bit, index of the bit
+///     @return  0: error
+///              1: ok
+///     @note    A READ and a WRITE per call, the write is skipped when the
+///              bit does not change. Not the fast path for many bits, see
+///              writeBytes().
+**/
+boolean FRAM_MB85RS_Bitmap::clear(uint32_t bit)
+{
+    return _writeBit(bit, false);
+}
+
+
+
+/*!
+///     @brief   setRange()
+///              Set consecutive bits
+///     @param   firstBit, index of the first bit
+///     @param   nbBits, number of bits
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::setRange(uint32_t firstBit, uint32_t nbBits)
+{
+    return _writeRange(firstBit, nbBits, true);
+}
+
+
+
+/*!
+///     @brief   clearRange()
+///              Clear consecutive bits
+///     @param   firstBit, index of the first bit
+///     @param   nbBits, number of bits
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::clearRange(uint32_t firstBit, uint32_t nbBits)
+{
+    return _writeRange(firstBit, nbBits, false);
+}
+
+
+
+/*!
+///     @brief   readBytes()
+///              Read whole bytes of the bitmap in one burst, bit n of the
+///              bitmap is bit (n % 8) of values[n / 8 - firstByte]
+///     @param   firstByte, index of the first byte, bit firstByte * 8
+///     @param   values[], the bytes read
+///     @param   nbBytes, the number of bytes
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::readBytes(uint32_t firstByte, uint8_t values[], size_t nbBytes)
+{
+    uint32_t size = (_nbBits + 7) >> 3;
+
+    if (nbBytes == 0 || firstByte >= size || nbBytes > size - firstByte)
+        return false;
+
+    return _fram.readArray(_startAddr + firstByte, values, nbBytes);
+}
+
+
+
+/*!
+///     @brief   writeBytes()
+///              Write whole bytes of the bitmap in one burst, the batched
+///              path for many bits: update them in RAM, then write them
+///     @param   firstByte, index of the first byte, bit firstByte * 8
+///     @param   values[], the bytes to write
+///     @param   nbBytes, the number of bytes
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::writeBytes(uint32_t firstByte, uint8_t values[], size_t nbBytes)
+{
+    uint32_t size = (_nbBits + 7) >> 3;
+
+    if (nbBytes == 0 || firstByte >= size || nbBytes > size - firstByte)
+        return false;
+
+    return _fram.writeArray(_startAddr + firstByte, values, nbBytes);
+}
+
+
+
+/*!
+///     @brief   count()
+///              Count the bits set in a range
+///     @param   firstBit, index of the first bit
+///     @param   nbBits, number of bits
+///     @param   result, number of bits set
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::count(uint32_t firstBit, uint32_t nbBits, uint32_t *result)
+{
+    if (nbBits == 0 || firstBit >= _nbBits || nbBits > _nbBits - firstBit)
+        return false;
+
+    return _scan(firstBit, firstBit + nbBits, BITMAP_COUNT, result);
+}
+
+
+
+/*!
+///     @brief   findFirstSet()
+///              Find the first bit set from a position
+///     @param   fromBit, index where the search starts
+///     @return  the index of the bit, -1 if none or error
+**/
+int32_t FRAM_MB85RS_Bitmap::findFirstSet(uint32_t fromBit)
+{
+    uint32_t result;
+
+    if (fromBit >= _nbBits || !_scan(fromBit, _nbBits, BITMAP_FIRST_SET, &result))
+        return -1;
+
+    return (result < _nbBits) ? (int32_t)result : -1;
+}
+
+
+
+/*!
+///     @brief   findFirstClear()
+///              Find the first bit cleared from a position
+///     @param   fromBit, index where the search starts
+///     @return  the index of the bit, -1 if none or error
+**/
+int32_t FRAM_MB85RS_Bitmap::findFirstClear(uint32_t fromBit)
+{
+    uint32_t result;
+
+    if (fromBit >= _nbBits || !_scan(fromBit, _nbBits, BITMAP_FIRST_CLEAR, &result))
+        return -1;
+
+    return (result < _nbBits) ? (int32_t)result : -1;
+}
+
+
+
+/*!
+///    @brief   getSize()
+///    @return  number of bits of the bitmap
+**/
+uint32_t FRAM_MB85RS_Bitmap::getSize()
+{
+    return _nbBits;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _writeBit()
+///              Update one bit
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::_writeBit(uint32_t bit, boolean state)
+{
+    if (bit >= _nbBits)
+        return false;
+
+    return _updateByte(bit >> 3, 1 << (bit & 7), state);
+}
+
+
+
+/*!
+///     @brief   _writeRange()
+///              Update a range: masked edge bytes, one fill burst in between
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::_writeRange(uint32_t firstBit, uint32_t nbBits, boolean state)
+{
+    if (nbBits == 0 || firstBit >= _nbBits || nbBits > _nbBits - firstBit)
+        return false;
+
+    uint32_t lastBit = firstBit + nbBits - 1;
+    uint32_t firstByte = firstBit >> 3;
+    uint32_t lastByte = lastBit >> 3;
+
+    if (firstByte == lastByte)
+        return _updateByte(firstByte, (0xFF << (firstBit & 7)) & (0xFF >> (7 - (lastBit & 7))), state);
+
+    if ((firstBit & 7) != 0)
+    {
+        if (!_updateByte(firstByte, 0xFF << (firstBit & 7), state))
+            return false;
+        firstByte++;
+    }
+
+    if ((lastBit & 7) != 7)
+    {
+        if (!_updateByte(lastByte, 0xFF >> (7 - (lastBit & 7)), state))
+            return false;
+        lastByte--;
+    }
+
+    if (firstByte > lastByte)
+        return true;
+
+    return _fram.fillArray(_startAddr + firstByte, state ? 0xFF : 0x00, lastByte - firstByte + 1);
+}
+
+
+
+/*!
+///     @brief   _updateByte()
+///              Read-modify-write of the masked bits of a byte,
+///              the write is skipped when nothing changes
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::_updateByte(uint32_t byteIndex, uint8_t mask, boolean state)
+{
+    uint8_t value;
+
+    if (!_fram.read(_startAddr + byteIndex, &value))
+        return false;
+
+    uint8_t updated = state ? (value | mask) : (value & ~mask);
+
+    if (updated == value)
+        return true;
+
+    return _fram.write(_startAddr + byteIndex, updated);
+}
+
+
+
+/*!
+///     @brief   _scan()
+///              Stream bits [firstBit, endBit) in one READ, 32 bits at a time
+///     @param   mode, BITMAP_COUNT, BITMAP_FIRST_SET or BITMAP_FIRST_CLEAR
+///     @param   result, number of bits set, or index of the bit found
+///              (endBit when none)
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Bitmap::_scan(uint32_t firstBit, uint32_t endBit, uint8_t mode, uint32_t *result)
+{
+    uint32_t byteIndex = firstBit >> 3;
+    uint32_t lastByte = (endBit - 1) >> 3;
+
+    FramBitmapScanState st;
+    st.bit = byteIndex << 3;
+    st.firstBit = firstBit;
+    st.endBit = endBit;
+    st.mode = mode;
+    st.total = 0;
+    st.found = false;
+
+    // A find stops the stream on the first match
+    if (!_fram.readStream(_startAddr + byteIndex, lastByte - byteIndex + 1, framBitmapConsumer, &st)
+        && !st.found)
+        return false;
+
+    if (st.found)
+        *result = st.result;
+    else
+        *result = (mode == BITMAP_COUNT) ? st.total : endBit;
+
+    return true;
+}
@@ -0,0 +1,55 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Bitmap.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Persistent bitmap over a range of the MB85RS SPI FRAM series.
+    Bit n is bit (n % 8) of the byte (n / 8) from the start address.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_BITMAP_H__
+#define __FRAM_MB85RS_BITMAP_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+class FRAM_MB85RS_Bitmap
+{
+ public:
+    FRAM_MB85RS_Bitmap(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t nbBits);
+
+    boolean test(uint32_t bit, boolean *state);
+    boolean set(uint32_t bit);
+    boolean clear(uint32_t bit);
+    boolean setRange(uint32_t firstBit, uint32_t nbBits);
+    boolean clearRange(uint32_t firstBit, uint32_t nbBits);
+    boolean readBytes(uint32_t firstByte, uint8_t values[], size_t nbBytes);
+    boolean writeBytes(uint32_t firstByte, uint8_t values[], size_t nbBytes);
+
+    boolean count(uint32_t firstBit, uint32_t nbBits, uint32_t *result);
+    int32_t findFirstSet(uint32_t fromBit = 0);
+    int32_t findFirstClear(uint32_t fromBit = 0);
+
+    uint32_t getSize();
+
+
+ private:
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // F-RAM address of bit 0
+    uint32_t    _nbBits;        // Size of the bitmap
+
+    boolean     _writeBit(uint32_t bit, boolean state);
+    boolean     _writeRange(uint32_t firstBit, uint32_t nbBits, boolean state);
+    boolean     _updateByte(uint32_t byteIndex, uint8_t mask, boolean state);
+    boolean     _scan(uint32_t firstBit, uint32_t endBit, uint8_t mode, uint32_t *result);
+};
+
+
+
+#endif
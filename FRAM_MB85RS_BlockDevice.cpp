@@ -0,0 +1,230 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_BlockDevice.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Block device adapter for the MB85RS SPI FRAM series.
+
+    F-RAM has no erase cycle and no page boundary: a sector of any size is
+    read or programmed with a single READ or WRITE opcode, and contiguous
+    sectors are chained in the same burst.
+
+    LittleFS glue example, with bd a FRAM_MB85RS_BlockDevice:
+        read  -> bd.read(block, off, buffer, size)
+        prog  -> bd.program(block, off, buffer, size)
+        erase -> bd.eraseSectors(block, 1)
+        sync  -> bd.sync()
+        block_size = bd.getSectorSize(), block_count = bd.getSectorCount()
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_BlockDevice.h>
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_BlockDevice()
+///              Constructor
+///     @param   fram, the F-RAM device
+///     @param   startAddr, F-RAM address of the first sector
+///     @param   sectorSize, bytes per sector (256, 512...)
+///     @param   nbSectors, number of sectors, 0 to use the chip up to its end
+**/
+FRAM_MB85RS_BlockDevice::FRAM_MB85RS_BlockDevice(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint16_t sectorSize, uint32_t nbSectors)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _sectorSize = sectorSize;
+    _nbSectors = nbSectors;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   begin()
+///              Check the geometry against the chip, to be called once
+///              the F-RAM device is initialized
+///     @return  0: error, the sectors do not fit in the chip
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::begin()
+{
+    uint32_t maxAddr = _fram.getMaxMemAdr();
+
+    if (_sectorSize == 0 || _startAddr >= maxAddr)
+        return false;
+
+    if (_nbSectors == 0)
+        _nbSectors = (maxAddr - _startAddr) / _sectorSize;
+
+    if (_nbSectors == 0 || _nbSectors > (maxAddr - _startAddr) / _sectorSize)
+        return false;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   readSectors()
+///              Read consecutive sectors in one burst
+///     @param   sector, first sector to read
+///     @param   buffer, at least nbSectors * getSectorSize() bytes
+///     @param   nbSectors, number of sectors to read
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::readSectors(uint32_t sector, void *buffer, uint32_t nbSectors)
+{
+    if (nbSectors == 0 || sector >= _nbSectors || nbSectors > _nbSectors - sector)
+        return false;
+
+    return _fram.readArray(_startAddr + sector * _sectorSize, (uint8_t *)buffer, nbSectors * _sectorSize);
+}
+
+
+
+/*!
+///     @brief   writeSectors()
+///              Program consecutive sectors in one burst
+///     @param   sector, first sector to write
+///     @param   buffer, at least nbSectors * getSectorSize() bytes
+///     @param   nbSectors, number of sectors to write
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::writeSectors(uint32_t sector, const void *buffer, uint32_t nbSectors)
+{
+    if (nbSectors == 0 || sector >= _nbSectors || nbSectors > _nbSectors - sector)
+        return false;
+
+    return _fram.writeArray(_startAddr + sector * _sectorSize, (uint8_t *)buffer, nbSectors * _sectorSize);
+}
+
+
+
+/*!
+///     @brief   eraseSectors()
+///              F-RAM is written in place, erasing is a no-op.
+///              Sectors keep their content until they are programmed again.
+///     @param   sector, first sector to erase
+///     @param   nbSectors, number of sectors to erase
+///     @return  0: error, out of the device
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::eraseSectors(uint32_t sector, uint32_t nbSectors)
+{
+    return sector < _nbSectors && nbSectors <= _nbSectors - sector;
+}
+
+
+
+/*!
+///     @brief   read()
+///              Read part of a sector, or several sectors from an offset,
+///              in one burst
+///     @param   sector, sector to read from
+///     @param   offset, offset in the sector
+///     @param   buffer, the destination
+///     @param   size, number of bytes to read
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::read(uint32_t sector, uint32_t offset, void *buffer, uint32_t size)
+{
+    if (!_inRange(sector, offset, size))
+        return false;
+
+    return _fram.readArray(_startAddr + sector * _sectorSize + offset, (uint8_t *)buffer, size);
+}
+
+
+
+/*!
+///     @brief   program()
+///              Program part of a sector, or several sectors from an offset,
+///              in one burst
+///     @param   sector, sector to write to
+///     @param   offset, offset in the sector
+///     @param   buffer, the source
+///     @param   size, number of bytes to write
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::program(uint32_t sector, uint32_t offset, const void *buffer, uint32_t size)
+{
+    if (!_inRange(sector, offset, size))
+        return false;
+
+    return _fram.writeArray(_startAddr + sector * _sectorSize + offset, (uint8_t *)buffer, size);
+}
+
+
+
+/*!
+///     @brief   sync()
+///              Writes reach the cells before CS goes high, nothing to flush
+///     @return  1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::sync()
+{
+    return true;
+}
+
+
+
+/*!
+///    @brief   getSectorSize()
+///    @return  _sectorSize
+**/
+uint16_t FRAM_MB85RS_BlockDevice::getSectorSize()
+{
+    return _sectorSize;
+}
+
+
+
+/*!
+///    @brief   getSectorCount()
+///    @return  _nbSectors, valid after begin()
+**/
+uint32_t FRAM_MB85RS_BlockDevice::getSectorCount()
+{
+    return _nbSectors;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _inRange()
+///              Check that a byte range stays within the device
+///     @return  0: out of the device or empty
+///              1: ok
+**/
+boolean FRAM_MB85RS_BlockDevice::_inRange(uint32_t sector, uint32_t offset, uint32_t size)
+{
+    if (size == 0 || sector >= _nbSectors)
+        return false;
+
+    uint32_t remaining = (_nbSectors - sector) * _sectorSize;
+
+    return offset < remaining && size <= remaining - offset;
+}
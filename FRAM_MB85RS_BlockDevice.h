@@ -0,0 +1,53 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_BlockDevice.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Block device adapter for the MB85RS SPI FRAM series, to put
+    LittleFS or FatFS style filesystems on F-RAM.
+    Every sector access is one burst on the bus, whatever its size.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_BLOCKDEVICE_H__
+#define __FRAM_MB85RS_BLOCKDEVICE_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+class FRAM_MB85RS_BlockDevice
+{
+ public:
+    FRAM_MB85RS_BlockDevice(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint16_t sectorSize, uint32_t nbSectors = 0);
+
+    boolean begin();
+
+    boolean readSectors(uint32_t sector, void *buffer, uint32_t nbSectors);
+    boolean writeSectors(uint32_t sector, const void *buffer, uint32_t nbSectors);
+    boolean eraseSectors(uint32_t sector, uint32_t nbSectors);
+
+    boolean read(uint32_t sector, uint32_t offset, void *buffer, uint32_t size);
+    boolean program(uint32_t sector, uint32_t offset, const void *buffer, uint32_t size);
+    boolean sync();
+
+    uint16_t getSectorSize();
+    uint32_t getSectorCount();
+
+
+ private:
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // F-RAM address of sector 0
+    uint16_t    _sectorSize;    // Bytes per sector
+    uint32_t    _nbSectors;     // Number of sectors, 0 until begin() when sized on the chip
+
+    boolean     _inRange(uint32_t sector, uint32_t offset, uint32_t size);
+};
+
+
+
+#endif
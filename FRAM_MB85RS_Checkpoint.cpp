@@ -0,0 +1,448 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Checkpoint.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Incremental checkpoint of a RAM region on the MB85RS SPI FRAM series.
+
+    F-RAM layout from startAddr:
+        [0..3]  CHECKPOINT_MAGIC, written after the first complete save()
+        [4..7]  size of the region
+        [8.. ]  image of the region
+
+    Changed pages are detected either by comparing the region with a
+    shadow copy (exact, costs the size of the region in RAM) or by a
+    32-bits hash per page (4 bytes of RAM per page).
+    A save() is not atomic: cut by a power loss, it leaves a mix of old
+    and new pages, and the page being written may be torn. Keep two
+    checkpoints and a sequence number in the region when the image has to
+    stay consistent.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_Checkpoint.h>
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_Checkpoint()
+///              Constructor, a region has to be attached before use
+///     @param   fram, the F-RAM device
+///     @param   startAddr, F-RAM address of the checkpoint
+///              CHECKPOINT_HEADER_SIZE + size of the region are used
+**/
+FRAM_MB85RS_Checkpoint::FRAM_MB85RS_Checkpoint(FRAM_MB85RS_SPI &fram, uint32_t startAddr)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _region = NULL;
+    _size = 0;
+    _pageSize = 0;
+    _nbPages = 0;
+    _signatures = NULL;
+    _shadow = NULL;
+    _headerValid = false;
+
+    _dirtyPages = 0;
+    _runsWritten = 0;
+    _bytesWritten = 0;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   attach()
+///              Register the RAM region, changes detected by hashing
+///     @param   region, the RAM region to checkpoint
+///     @param   size, size of the region in bytes
+///     @param   pageSize, granularity of the change detection
+///     @param   signatures[], one entry per page, filled by the class
+///     @return  0: error, too many pages
+///              1: ok, every page is dirty until restore() or save()
+**/
+boolean FRAM_MB85RS_Checkpoint::attach(void *region, size_t size, uint16_t pageSize, uint32_t signatures[])
+{
+    if (!_attach(region, size, pageSize))
+        return false;
+
+    _signatures = signatures;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   attach()
+///              Register the RAM region, changes detected by comparison
+///     @param   region, the RAM region to checkpoint
+///     @param   size, size of the region in bytes
+///     @param   pageSize, granularity of the change detection
+///     @param   shadow[], size bytes, filled by the class
+///     @return  0: error, too many pages
+///              1: ok, every page is dirty until restore() or save()
+**/
+boolean FRAM_MB85RS_Checkpoint::attach(void *region, size_t size, uint16_t pageSize, uint8_t shadow[])
+{
+    if (!_attach(region, size, pageSize))
+        return false;
+
+    _shadow = shadow;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   restore()
+///              Reload the region from the last checkpoint in one read
+///     @return  0: error, no checkpoint of this size on F-RAM
+///              1: ok
+**/
+boolean FRAM_MB85RS_Checkpoint::restore()
+{
+    if (_region == NULL)
+        return false;
+
+    uint8_t header[CHECKPOINT_HEADER_SIZE];
+    if (!_fram.readArray(_startAddr, header, CHECKPOINT_HEADER_SIZE))
+        return false;
+
+    uint32_t magic = (uint32_t)header[0] | ((uint32_t)header[1] << 8)
+                   | ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+    uint32_t size = (uint32_t)header[4] | ((uint32_t)header[5] << 8)
+                  | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+
+    if (magic != CHECKPOINT_MAGIC || size != _size)
+        return false;
+
+    if (!_fram.readArray(_startAddr + CHECKPOINT_HEADER_SIZE, _region, _size))
+        return false;
+
+    for (uint16_t page = 0; page < _nbPages; page++)
+    {
+        _pageChanged(page);
+        _pageSaved(page);
+    }
+
+    memset(_dirty, 0, sizeof(_dirty));
+    _headerValid = true;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   save()
+///              Write the pages changed since the last checkpoint.
+///              Runs of consecutive dirty pages are written in one burst.
+///     @return  0: error, pages not written stay dirty
+///              1: ok
+///     @note    Not atomic, the image on F-RAM is only consistent once
+///              save() has returned 1
+**/
+boolean FRAM_MB85RS_Checkpoint::save()
+{
+    if (_region == NULL)
+        return false;
+
+    _dirtyPages = 0;
+    _runsWritten = 0;
+    _bytesWritten = 0;
+
+    // Detection pass
+    for (uint16_t page = 0; page < _nbPages; page++)
+    {
+        if (_pageChanged(page))
+            _setDirty(page);
+        if (_isDirty(page))
+            _dirtyPages++;
+    }
+
+    // Write pass, coalescing consecutive dirty pages
+    uint16_t page = 0;
+    while (page < _nbPages)
+    {
+        if (!_isDirty(page))
+        {
+            page++;
+            continue;
+        }
+
+        uint16_t first = page;
+        uint32_t offset = (uint32_t)first * _pageSize;
+        uint32_t length = 0;
+
+        while (page < _nbPages && _isDirty(page))
+            length += _pageLength(page++);
+
+        if (!_fram.writeArray(_startAddr + CHECKPOINT_HEADER_SIZE + offset, &_region[offset], length))
+            return false;
+
+        for (uint16_t p = first; p < page; p++)
+        {
+            _pageSaved(p);
+            _dirty[p >> 3] &= ~(1 << (p & 7));
+        }
+
+        _runsWritten++;
+        _bytesWritten += length;
+    }
+
+    // The header validates the image once it has been fully written
+    if (!_headerValid)
+    {
+        uint8_t header[CHECKPOINT_HEADER_SIZE];
+        uint32_t magic = CHECKPOINT_MAGIC;
+        uint32_t size = _size;
+
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            header[i] = (magic >> (8 * i)) & 0xFF;
+            header[4 + i] = (size >> (8 * i)) & 0xFF;
+        }
+
+        if (!_fram.writeArray(_startAddr, header, CHECKPOINT_HEADER_SIZE))
+            return false;
+
+        _headerValid = true;
+        _bytesWritten += CHECKPOINT_HEADER_SIZE;
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   markDirty()
+///              Force pages to be written on next save(), whatever
+///              the change detection finds
+///     @param   offset, first byte changed in the region
+///     @param   length, number of bytes changed
+**/
+void FRAM_MB85RS_Checkpoint::markDirty(size_t offset, size_t length)
+{
+    if (_region == NULL || length == 0 || offset >= _size)
+        return;
+
+    if (length > _size - offset)
+        length = _size - offset;
+
+    for (uint16_t page = offset / _pageSize; page <= (offset + length - 1) / _pageSize; page++)
+        _setDirty(page);
+}
+
+
+
+/*!
+///    @brief   getPageCount()
+///    @return  number of pages of the region
+**/
+uint16_t FRAM_MB85RS_Checkpoint::getPageCount()
+{
+    return _nbPages;
+}
+
+
+
+/*!
+///    @brief   getDirtyPages()
+///    @return  number of pages found dirty by the last save()
+**/
+uint16_t FRAM_MB85RS_Checkpoint::getDirtyPages()
+{
+    return _dirtyPages;
+}
+
+
+
+/*!
+///    @brief   getRunsWritten()
+///    @return  number of bursts written by the last save()
+**/
+uint16_t FRAM_MB85RS_Checkpoint::getRunsWritten()
+{
+    return _runsWritten;
+}
+
+
+
+/*!
+///    @brief   getBytesWritten()
+///    @return  number of bytes written by the last save()
+**/
+uint32_t FRAM_MB85RS_Checkpoint::getBytesWritten()
+{
+    return _bytesWritten;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _attach()
+///              Common part of attach(), every page is set dirty
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Checkpoint::_attach(void *region, size_t size, uint16_t pageSize)
+{
+    _region = NULL;
+
+    if (region == NULL || size == 0 || pageSize == 0
+        || (size + pageSize - 1) / pageSize > CHECKPOINT_MAX_PAGES)
+        return false;
+
+    _region = (uint8_t *)region;
+    _size = size;
+    _pageSize = pageSize;
+    _nbPages = (size + pageSize - 1) / pageSize;
+    _signatures = NULL;
+    _shadow = NULL;
+    _headerValid = false;
+
+    memset(_dirty, 0xFF, sizeof(_dirty));
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _pageLength()
+///     @return  size of a page, the last one may be shorter
+**/
+uint16_t FRAM_MB85RS_Checkpoint::_pageLength(uint16_t page)
+{
+    size_t offset = (size_t)page * _pageSize;
+
+    return (_size - offset < _pageSize) ? (_size - offset) : _pageSize;
+}
+
+
+
+/*!
+///     @brief   _pageChanged()
+///              Compare a page with its state at the last checkpoint.
+///              In hash mode the new signature is stored right away,
+///              the dirty bit keeps the page until it is written.
+///     @return  0: unchanged
+///              1: changed
+**/
+boolean FRAM_MB85RS_Checkpoint::_pageChanged(uint16_t page)
+{
+    size_t offset = (size_t)page * _pageSize;
+    uint16_t length = _pageLength(page);
+
+    if (_shadow != NULL)
+    {
+        // Word-wide XOR accumulation, no early exit so the loop vectorizes
+        const uint8_t *a = &_region[offset];
+        const uint8_t *b = &_shadow[offset];
+        uint32_t diff = 0;
+        uint16_t i = 0;
+
+        for (; i + 4 <= length; i += 4)
+        {
+            uint32_t x, y;
+            memcpy(&x, &a[i], 4);
+            memcpy(&y, &b[i], 4);
+            diff |= x ^ y;
+        }
+        for (; i < length; i++)
+            diff |= a[i] ^ b[i];
+
+        return diff != 0;
+    }
+
+    if (_signatures != NULL)
+    {
+        uint32_t signature = _hash(&_region[offset], length);
+        boolean changed = (signature != _signatures[page]);
+        _signatures[page] = signature;
+        return changed;
+    }
+
+    return true; // No detection, every page is always written
+}
+
+
+
+/*!
+///     @brief   _pageSaved()
+///              Update the reference of a page once written
+**/
+void FRAM_MB85RS_Checkpoint::_pageSaved(uint16_t page)
+{
+    if (_shadow != NULL)
+    {
+        size_t offset = (size_t)page * _pageSize;
+        memcpy(&_shadow[offset], &_region[offset], _pageLength(page));
+    }
+}
+
+
+
+/*!
+///     @brief   _isDirty()
+///     @return  state of the page in the dirty bitmap
+**/
+boolean FRAM_MB85RS_Checkpoint::_isDirty(uint16_t page)
+{
+    return (_dirty[page >> 3] >> (page & 7)) & 1;
+}
+
+
+
+/*!
+///     @brief   _setDirty()
+///              Set a page in the dirty bitmap
+**/
+void FRAM_MB85RS_Checkpoint::_setDirty(uint16_t page)
+{
+    _dirty[page >> 3] |= 1 << (page & 7);
+}
+
+
+
+/*!
+///     @brief   _hash()
+///              FNV-1a hash computed on 32-bits words
+///     @return  the signature of the data
+**/
+uint32_t FRAM_MB85RS_Checkpoint::_hash(const uint8_t *data, uint16_t length)
+{
+    uint32_t h = 0x811C9DC5;
+    uint16_t i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, &data[i], 4);
+        h = (h ^ w) * 0x01000193;
+    }
+    for (; i < length; i++)
+        h = (h ^ data[i]) * 0x01000193;
+
+    return h;
+}
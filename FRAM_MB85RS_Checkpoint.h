@@ -0,0 +1,82 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Checkpoint.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Incremental checkpoint of a RAM region on the MB85RS SPI FRAM series.
+    The region is split in pages, only the pages changed since the last
+    checkpoint are written, adjacent ones in the same burst.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_CHECKPOINT_H__
+#define __FRAM_MB85RS_CHECKPOINT_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+// DEFINES
+
+// Maximum number of pages of a region, sizes the dirty-page bitmap
+#ifndef CHECKPOINT_MAX_PAGES
+    #define CHECKPOINT_MAX_PAGES 256
+#endif
+
+// Header in front of the checkpoint data: magic (32-bits) + region size (32-bits)
+#define CHECKPOINT_MAGIC        0x54504B43 // "CKPT"
+#define CHECKPOINT_HEADER_SIZE  8
+
+
+class FRAM_MB85RS_Checkpoint
+{
+ public:
+    FRAM_MB85RS_Checkpoint(FRAM_MB85RS_SPI &fram, uint32_t startAddr);
+
+    boolean attach(void *region, size_t size, uint16_t pageSize, uint32_t signatures[]);
+    boolean attach(void *region, size_t size, uint16_t pageSize, uint8_t shadow[]);
+
+    boolean restore();
+    boolean save();
+    void    markDirty(size_t offset, size_t length);
+
+    uint16_t getPageCount();
+    uint16_t getDirtyPages();
+    uint16_t getRunsWritten();
+    uint32_t getBytesWritten();
+
+
+ private:
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // F-RAM address of the header
+    uint8_t    *_region;        // RAM region saved
+    size_t      _size;          // Size of the region
+    uint16_t    _pageSize;      // Bytes per page
+    uint16_t    _nbPages;       // Number of pages, the last one may be partial
+    uint32_t   *_signatures;    // Per page hash, when change detection is hash-based
+    uint8_t    *_shadow;        // Copy of the last checkpoint, when compare-based
+    boolean     _headerValid;   // Header already on F-RAM for this region
+
+    uint8_t     _dirty[(CHECKPOINT_MAX_PAGES + 7) / 8];    // Pages to write on next save()
+
+    uint16_t    _dirtyPages;    // Statistics of the last save()
+    uint16_t    _runsWritten;
+    uint32_t    _bytesWritten;
+
+    boolean     _attach(void *region, size_t size, uint16_t pageSize);
+    uint16_t    _pageLength(uint16_t page);
+    boolean     _pageChanged(uint16_t page);
+    void        _pageSaved(uint16_t page);
+    boolean     _isDirty(uint16_t page);
+    void        _setDirty(uint16_t page);
+
+    static uint32_t _hash(const uint8_t *data, uint16_t length);
+};
+
+
+
+#endif
@@ -0,0 +1,537 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_DeltaLog.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Compressed time-series log for the MB85RS SPI FRAM series.
+
+    Block layout on F-RAM (DELTALOG_BLOCK_SIZE bytes):
+        [0..1]  number of samples in the block, 0 when the block is free
+        [2..5]  index of the first sample of the block in the whole log
+        [6.. ]  anchor sample, then one delta per sample, all encoded
+                as zigzag varints (1 byte for a delta within -64..63)
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_DeltaLog.h>
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_DeltaLog()
+///              Constructor, nothing is read or written before begin() or format()
+///     @param   fram, the initialized F-RAM device
+///     @param   startAddr, first F-RAM address used by the log
+///     @param   nbBlocks, number of DELTALOG_BLOCK_SIZE blocks owned by the log
+**/
+FRAM_MB85RS_DeltaLog::FRAM_MB85RS_DeltaLog(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t nbBlocks)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _nbBlocks = nbBlocks;
+
+    _wrBlock = 0;
+    _sampleCount = 0;
+    _newBlock(0);
+    _rdValid = false;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   format()
+///              Mark every block of the log as free and empty the log
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::format()
+{
+    uint8_t header[DELTALOG_HEADER_SIZE];
+    memset(header, 0, DELTALOG_HEADER_SIZE);
+
+    for (uint32_t i = 0; i < _nbBlocks; i++)
+        if (!_fram.writeArray(_blockAddr(i), header, DELTALOG_HEADER_SIZE))
+            return false;
+
+    _wrBlock = 0;
+    _sampleCount = 0;
+    _newBlock(0);
+    _rdValid = false;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Find the end of an existing log and reload its last block
+///              so that append() carries on where it stopped
+///     @return  0: error, the log has not been formatted or is corrupted
+///              1: ok
+///     @note    Blocks are filled in order, the first free block is found
+///              by a binary search over the block headers
+**/
+boolean FRAM_MB85RS_DeltaLog::begin()
+{
+    uint32_t lo = 0, hi = _nbBlocks;
+    uint16_t count;
+    uint32_t firstIndex;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (!_readHeader(mid, &count, &firstIndex))
+            return false;
+
+        if (count > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    _rdValid = false;
+    _wrBlock = 0;
+    _sampleCount = 0;
+    _newBlock(0);
+
+    if (lo == 0)
+        return true; // Empty log
+
+    // Reload the last used block to continue its delta chain
+    _wrBlock = lo - 1;
+    if (!_fram.readArray(_blockAddr(_wrBlock), _wrBuffer, DELTALOG_BLOCK_SIZE))
+        return false;
+
+    count = (uint16_t)_wrBuffer[0] | ((uint16_t)_wrBuffer[1] << 8);
+    firstIndex = (uint32_t)_wrBuffer[2] | ((uint32_t)_wrBuffer[3] << 8)
+                | ((uint32_t)_wrBuffer[4] << 16) | ((uint32_t)_wrBuffer[5] << 24);
+
+    uint16_t position = DELTALOG_HEADER_SIZE;
+    int32_t value, previous = 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (!_decode(_wrBuffer, DELTALOG_BLOCK_SIZE, &position, &value))
+            return false;
+        previous = (i == 0) ? value : (int32_t)((uint32_t)previous + (uint32_t)value);
+    }
+
+    // Bytes left over from an older content are not part of the block
+    memset(&_wrBuffer[position], 0, DELTALOG_BLOCK_SIZE - position);
+
+    _wrLength = position;
+    _wrCount = count;
+    _wrPrevious = previous;
+    _wrDirty = false;
+    _sampleCount = firstIndex + count;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   append()
+///              Append a sample to the log.
+///              The sample is buffered in RAM, the block is written on
+///              F-RAM in one burst once it is full or when flush() is called
+///     @param   sample, the value to store
+///     @return  0: error, log full
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::append(int32_t sample)
+{
+    uint8_t code[DELTALOG_VARINT_MAX];
+    uint8_t length = 0;
+
+    if (_wrCount > 0)
+    {
+        length = _encode((int32_t)((uint32_t)sample - (uint32_t)_wrPrevious), code);
+
+        if (_wrLength + length > DELTALOG_BLOCK_SIZE)
+        {
+            // Block full, the sample becomes the anchor of the next one
+            if (!_writeBlock())
+                return false;
+            _wrBlock++;
+            _newBlock(_sampleCount);
+        }
+    }
+
+    if (_wrCount == 0)
+    {
+        if (_wrBlock >= _nbBlocks)
+            return false;
+        length = _encode(sample, code);
+    }
+
+    memcpy(&_wrBuffer[_wrLength], code, length);
+    _wrLength += length;
+    _wrCount++;
+
+    _wrBuffer[0] = _wrCount & 0xFF;
+    _wrBuffer[1] = (_wrCount >> 8) & 0xFF;
+
+    _wrPrevious = sample;
+    _wrDirty = true;
+    _sampleCount++;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   flush()
+///              Write the block being filled to F-RAM
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::flush()
+{
+    return _writeBlock();
+}
+
+
+
+/*!
+///     @brief   seek()
+///              Position the reader on a sample of the log
+///     @param   sampleIndex, index of the sample, from 0 to getSampleCount()-1
+///     @return  0: error, out of the log
+///              1: ok, the next readNext() returns this sample
+///     @note    The block is found by a binary search over the block headers,
+///              then the block is read in one burst and decoded up to the sample
+**/
+boolean FRAM_MB85RS_DeltaLog::seek(uint32_t sampleIndex)
+{
+    if (sampleIndex >= _sampleCount)
+        return false;
+
+    // Search up to the last block holding samples, a full log has no
+    // block being filled
+    uint32_t lo = 0, hi = getBlockCount() - 1;
+    uint16_t count;
+    uint32_t firstIndex;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (!_readHeader(mid, &count, &firstIndex))
+            return false;
+
+        if (count > 0 && firstIndex <= sampleIndex)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    if (!_loadBlock(lo))
+        return false;
+
+    // Header of the loaded block, no second READ
+    firstIndex = (uint32_t)_rdBuffer[2] | ((uint32_t)_rdBuffer[3] << 8)
+               | ((uint32_t)_rdBuffer[4] << 16) | ((uint32_t)_rdBuffer[5] << 24);
+
+    int32_t value;
+    for (uint32_t i = firstIndex; i < sampleIndex; i++)
+        if (!readNext(&value))
+            return false;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   readNext()
+///              Decode the next sample, loading the following block when needed
+///     @param   sample, the value read
+///     @return  0: end of the log, or no seek() done
+///              1: ok
+///     @note    The block being filled is read from RAM as it was when the
+///              reader reached it
+**/
+boolean FRAM_MB85RS_DeltaLog::readNext(int32_t *sample)
+{
+    if (!_rdValid)
+        return false;
+
+    if (_rdRemaining == 0)
+    {
+        if (_rdBlock + 1 >= getBlockCount() || !_loadBlock(_rdBlock + 1) || _rdRemaining == 0)
+        {
+            _rdValid = false;
+            return false;
+        }
+    }
+
+    boolean anchor = (_rdPosition == DELTALOG_HEADER_SIZE);
+    int32_t value;
+
+    if (!_decode(_rdBuffer, DELTALOG_BLOCK_SIZE, &_rdPosition, &value))
+    {
+        _rdValid = false;
+        return false;
+    }
+
+    _rdPrevious = anchor ? value : (int32_t)((uint32_t)_rdPrevious + (uint32_t)value);
+    _rdRemaining--;
+
+    *sample = _rdPrevious;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   readBlock()
+///              Decode a complete block, blocks being independent from each other
+///     @param   blockIndex, index of the block, from 0 to getBlockCount()-1
+///     @param   samples[], the array receiving the samples
+///     @param   maxSamples, size of samples[]
+///     @return  the number of samples decoded, 0 on error
+///     @note    The reader is left after the last decoded sample
+**/
+uint16_t FRAM_MB85RS_DeltaLog::readBlock(uint32_t blockIndex, int32_t samples[], uint16_t maxSamples)
+{
+    if (blockIndex >= getBlockCount() || !_loadBlock(blockIndex))
+        return 0;
+
+    uint16_t i = 0;
+    while (i < maxSamples && _rdRemaining > 0 && readNext(&samples[i]))
+        i++;
+
+    return i;
+}
+
+
+
+/*!
+///    @brief   getSampleCount()
+///             Return the number of samples in the log, buffered ones included
+///    @return  _sampleCount
+**/
+uint32_t FRAM_MB85RS_DeltaLog::getSampleCount()
+{
+    return _sampleCount;
+}
+
+
+
+/*!
+///    @brief   getBlockCount()
+///             Return the number of blocks holding samples
+///    @return  number of blocks used
+**/
+uint32_t FRAM_MB85RS_DeltaLog::getBlockCount()
+{
+    return _wrBlock + (_wrCount > 0 ? 1 : 0);
+}
+
+
+
+/*!
+///    @brief   getBytesUsed()
+///             Return the F-RAM space used by the log, padding of the
+///             full blocks included. Compare with getSampleCount() times
+///             the raw sample size to get the compression ratio.
+///    @return  number of bytes used
+**/
+uint32_t FRAM_MB85RS_DeltaLog::getBytesUsed()
+{
+    return _wrBlock * DELTALOG_BLOCK_SIZE + (_wrCount > 0 ? _wrLength : 0);
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _blockAddr()
+///              F-RAM address of a block
+///     @param   blockIndex, index of the block
+///     @return  the address
+**/
+uint32_t FRAM_MB85RS_DeltaLog::_blockAddr(uint32_t blockIndex)
+{
+    return _startAddr + blockIndex * DELTALOG_BLOCK_SIZE;
+}
+
+
+
+/*!
+///     @brief   _readHeader()
+///              Read the header of a block, from RAM for the block being filled
+///     @param   blockIndex, index of the block
+///     @param   count, number of samples in the block
+///     @param   firstIndex, index of the first sample of the block
+///     @return  0: error, out of the log
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::_readHeader(uint32_t blockIndex, uint16_t *count, uint32_t *firstIndex)
+{
+    uint8_t header[DELTALOG_HEADER_SIZE];
+
+    if (blockIndex >= _nbBlocks)
+        return false;
+
+    if (blockIndex == _wrBlock && _wrCount > 0)
+        memcpy(header, _wrBuffer, DELTALOG_HEADER_SIZE);
+    else if (!_fram.readArray(_blockAddr(blockIndex), header, DELTALOG_HEADER_SIZE))
+        return false;
+
+    *count = (uint16_t)header[0] | ((uint16_t)header[1] << 8);
+    *firstIndex = (uint32_t)header[2] | ((uint32_t)header[3] << 8)
+                | ((uint32_t)header[4] << 16) | ((uint32_t)header[5] << 24);
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _loadBlock()
+///              Load a block in the read buffer and rewind the decoder on it
+///     @param   blockIndex, index of the block
+///     @return  0: error, out of the log
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::_loadBlock(uint32_t blockIndex)
+{
+    _rdValid = false;
+
+    if (blockIndex >= _nbBlocks)
+        return false;
+
+    if (blockIndex == _wrBlock && _wrCount > 0)
+        memcpy(_rdBuffer, _wrBuffer, DELTALOG_BLOCK_SIZE);
+    else if (!_fram.readArray(_blockAddr(blockIndex), _rdBuffer, DELTALOG_BLOCK_SIZE))
+        return false;
+
+    _rdBlock = blockIndex;
+    _rdPosition = DELTALOG_HEADER_SIZE;
+    _rdRemaining = (uint16_t)_rdBuffer[0] | ((uint16_t)_rdBuffer[1] << 8);
+    _rdPrevious = 0;
+    _rdValid = true;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _writeBlock()
+///              Write the used part of the block being filled in one burst
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::_writeBlock()
+{
+    if (!_wrDirty)
+        return true;
+
+    if (!_fram.writeArray(_blockAddr(_wrBlock), _wrBuffer, _wrLength))
+        return false;
+
+    _wrDirty = false;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _newBlock()
+///              Reset the write buffer for an empty block
+///     @param   firstIndex, index of the first sample of the block
+**/
+void FRAM_MB85RS_DeltaLog::_newBlock(uint32_t firstIndex)
+{
+    memset(_wrBuffer, 0, DELTALOG_BLOCK_SIZE);
+    _wrBuffer[2] = firstIndex & 0xFF;
+    _wrBuffer[3] = (firstIndex >> 8) & 0xFF;
+    _wrBuffer[4] = (firstIndex >> 16) & 0xFF;
+    _wrBuffer[5] = (firstIndex >> 24) & 0xFF;
+
+    _wrLength = DELTALOG_HEADER_SIZE;
+    _wrCount = 0;
+    _wrPrevious = 0;
+    _wrDirty = false;
+}
+
+
+
+/*!
+///     @brief   _encode()
+///              Zigzag + varint encoding of a signed value,
+///              7 bits per byte, bit 7 set when another byte follows
+///     @param   value, the value to encode
+///     @param   out, at least DELTALOG_VARINT_MAX bytes
+///     @return  the number of bytes written in out
+**/
+uint8_t FRAM_MB85RS_DeltaLog::_encode(int32_t value, uint8_t *out)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    uint8_t length = 0;
+
+    while (zigzag >= 0x80)
+    {
+        out[length++] = (zigzag & 0x7F) | 0x80;
+        zigzag >>= 7;
+    }
+    out[length++] = zigzag;
+
+    return length;
+}
+
+
+
+/*!
+///     @brief   _decode()
+///              Decode one zigzag varint
+///     @param   in, the buffer to decode from
+///     @param   length, the size of the buffer
+///     @param   position, the offset of the varint, moved after it
+///     @param   value, the decoded value
+///     @return  0: error, truncated or malformed varint
+///              1: ok
+**/
+boolean FRAM_MB85RS_DeltaLog::_decode(const uint8_t *in, uint16_t length, uint16_t *position, int32_t *value)
+{
+    uint32_t zigzag = 0;
+    uint8_t shift = 0;
+
+    while (*position < length && shift < 7 * DELTALOG_VARINT_MAX)
+    {
+        uint8_t b = in[(*position)++];
+        zigzag |= (uint32_t)(b & 0x7F) << shift;
+
+        if (!(b & 0x80))
+        {
+            *value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            return true;
+        }
+        shift += 7;
+    }
+
+    return false;
+}
@@ -0,0 +1,94 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_DeltaLog.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Compressed time-series log for the MB85RS SPI FRAM series.
+    Samples are stored as delta + zigzag varint in fixed-size blocks,
+    every block starting with an absolute anchor so that it can be
+    decoded on its own.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_DELTALOG_H__
+#define __FRAM_MB85RS_DELTALOG_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+// DEFINES
+
+// Size of one compressed block on F-RAM, header included.
+// One block is written as a single burst and buffered in RAM twice
+// (write and read side), so keep it small on AVR targets.
+#ifndef DELTALOG_BLOCK_SIZE
+    #define DELTALOG_BLOCK_SIZE 64
+#endif
+
+// Block header: number of samples (16-bits) + index of the first sample (32-bits)
+#define DELTALOG_HEADER_SIZE 6
+
+// A zigzag varint of a 32-bits value never takes more than 5 bytes
+#define DELTALOG_VARINT_MAX 5
+
+
+class FRAM_MB85RS_DeltaLog
+{
+ public:
+    FRAM_MB85RS_DeltaLog(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t nbBlocks);
+
+    boolean format();
+    boolean begin();
+
+    boolean append(int32_t sample);
+    boolean flush();
+
+    boolean seek(uint32_t sampleIndex);
+    boolean readNext(int32_t *sample);
+    uint16_t readBlock(uint32_t blockIndex, int32_t samples[], uint16_t maxSamples);
+
+    uint32_t getSampleCount();
+    uint32_t getBlockCount();
+    uint32_t getBytesUsed();
+
+
+ private:
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // First F-RAM address of the log
+    uint32_t    _nbBlocks;      // Number of blocks available
+
+    // Write side
+    uint8_t     _wrBuffer[DELTALOG_BLOCK_SIZE];
+    uint32_t    _wrBlock;       // Block being filled
+    uint16_t    _wrLength;      // Bytes used in _wrBuffer
+    uint16_t    _wrCount;       // Samples stored in _wrBuffer
+    int32_t     _wrPrevious;    // Last sample appended
+    boolean     _wrDirty;       // _wrBuffer holds data not yet on F-RAM
+    uint32_t    _sampleCount;   // Total number of samples in the log
+
+    // Read side
+    uint8_t     _rdBuffer[DELTALOG_BLOCK_SIZE];
+    uint32_t    _rdBlock;       // Block loaded in _rdBuffer
+    uint16_t    _rdPosition;    // Next byte to decode in _rdBuffer
+    uint16_t    _rdRemaining;   // Samples left to decode in _rdBuffer
+    int32_t     _rdPrevious;    // Last sample decoded
+    boolean     _rdValid;       // _rdBuffer holds a decoded block
+
+    uint32_t    _blockAddr(uint32_t blockIndex);
+    boolean     _readHeader(uint32_t blockIndex, uint16_t *count, uint32_t *firstIndex);
+    boolean     _loadBlock(uint32_t blockIndex);
+    boolean     _writeBlock();
+    void        _newBlock(uint32_t firstIndex);
+
+    static uint8_t  _encode(int32_t value, uint8_t *out);
+    static boolean  _decode(const uint8_t *in, uint16_t length, uint16_t *position, int32_t *value);
+};
+
+
+
+#endif
@@ -0,0 +1,377 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Log.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Circular append log for the MB85RS SPI FRAM series.
+
+    Block n of the log is stored at index (n - 1) % nbBlocks and starts
+    with its sequence number, so in a valid log seq[i] == seq[0] + i up to
+    the last block written and the test fails right after it, wrapped or
+    not. mount() finds that point with a binary search reading 4 bytes per
+    probe, then checks the CRC of the last and oldest blocks only: a block
+    is written in one burst, a power loss can only tear the one being
+    written, and that one takes the slot of the oldest block.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_Log.h>
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_Log()
+///              Constructor
+///     @param   fram, the F-RAM device
+///     @param   startAddr, F-RAM address of the first block
+///     @param   blockSize, bytes per block, LOG_HEADER_SIZE included,
+///              LOG_MAX_BLOCK_SIZE at most
+///     @param   nbBlocks, number of blocks, 2 at least
+**/
+FRAM_MB85RS_Log::FRAM_MB85RS_Log(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint16_t blockSize, uint32_t nbBlocks)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _blockSize = blockSize;
+    _nbBlocks = nbBlocks;
+    _firstSeq = 0;
+    _lastSeq = 0;
+    _mountTime = 0;
+    _mountBytes = 0;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   format()
+///              Empty the log, clears the header of every block
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Log::format()
+{
+    if (_blockSize <= LOG_HEADER_SIZE || _blockSize > LOG_MAX_BLOCK_SIZE || _nbBlocks < 2)
+        return false;
+
+    for (uint32_t i = 0; i < _nbBlocks; i++)
+        if (!_fram.fillArray(_startAddr + i * _blockSize, 0x00, LOG_HEADER_SIZE))
+            return false;
+
+    _firstSeq = 0;
+    _lastSeq = 0;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   mount()
+///              Find the first and last blocks of the log after a reset,
+///              in O(log nbBlocks) header reads
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Log::mount()
+{
+    uint32_t start = framMicros();
+    uint32_t seq0, seq;
+
+    _firstSeq = 0;
+    _lastSeq = 0;
+    _mountBytes = 0;
+
+    if (_blockSize <= LOG_HEADER_SIZE || _blockSize > LOG_MAX_BLOCK_SIZE || _nbBlocks < 2)
+        return false;
+
+    if (!_readSeq(0, &seq0))
+        return false;
+
+    uint32_t last = 0;
+
+    // Block 0 always holds seq 1 + k * nbBlocks
+    if (seq0 != 0 && (seq0 - 1) % _nbBlocks == 0)
+    {
+        // Last index i where seq[i] == seq0 + i
+        uint32_t lo = 0, hi = _nbBlocks - 1;
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo + 1) / 2;
+
+            if (!_readSeq(mid, &seq))
+                return false;
+
+            if (seq == seq0 + mid)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+
+        last = seq0 + lo;
+
+        // A torn last block falls back to the previous one, which must be intact
+        _mountBytes += _blockSize;
+        if (!_checkBlock(last, NULL, NULL))
+        {
+            last--;
+            _mountBytes += _blockSize;
+            if (last != 0 && !_checkBlock(last, NULL, NULL))
+                last = 0;
+        }
+    }
+
+    if (last == 0)
+    {
+        // Block 0 torn while starting a new lap, the log ends on the last block
+        if (!_readSeq(_nbBlocks - 1, &seq))
+            return false;
+
+        if (seq != 0 && seq % _nbBlocks == 0)
+        {
+            _mountBytes += _blockSize;
+            if (_checkBlock(seq, NULL, NULL))
+                last = seq;
+        }
+    }
+
+    if (last != 0)
+    {
+        _lastSeq = last;
+        _firstSeq = 1;
+
+        if (last >= _nbBlocks)
+        {
+            // The oldest block shares its slot with the next one, an
+            // interrupted append may have damaged it
+            _firstSeq = last - _nbBlocks + 1;
+            _mountBytes += _blockSize;
+            if (!_checkBlock(_firstSeq, NULL, NULL))
+                _firstSeq++;
+        }
+    }
+
+    _mountTime = framMicros() - start;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   append()
+///              Write a new block at the end of the log, in one burst.
+///              The oldest block is dropped once the log is full.
+///     @param   data, the payload
+///     @param   length, bytes of payload, getPayloadSize() at most
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Log::append(const uint8_t data[], uint16_t length)
+{
+    uint8_t block[LOG_MAX_BLOCK_SIZE];
+    uint32_t seq = _lastSeq + 1;
+
+    if (_blockSize <= LOG_HEADER_SIZE || _blockSize > LOG_MAX_BLOCK_SIZE || _nbBlocks < 2
+        || length > getPayloadSize() || seq == 0)
+        return false;
+
+    block[0] = seq & 0xFF;
+    block[1] = (seq >> 8) & 0xFF;
+    block[2] = (seq >> 16) & 0xFF;
+    block[3] = (seq >> 24) & 0xFF;
+    block[4] = length & 0xFF;
+    block[5] = length >> 8;
+    memcpy(&block[LOG_HEADER_SIZE], data, length);
+
+    uint16_t crc = _crc16(0xFFFF, block, 6);
+    crc = _crc16(crc, &block[LOG_HEADER_SIZE], length);
+    block[6] = crc & 0xFF;
+    block[7] = crc >> 8;
+
+    if (!_fram.writeArray(_blockAddr(seq), block, LOG_HEADER_SIZE + length))
+        return false;
+
+    _lastSeq = seq;
+    if (_firstSeq == 0)
+        _firstSeq = seq;
+    else if (_lastSeq - _firstSeq >= _nbBlocks)
+        _firstSeq = _lastSeq - _nbBlocks + 1;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   read()
+///              Read a block of the log, its sequence number and CRC are checked
+///     @param   seq, sequence number, from getFirstSeq() to getLastSeq()
+///     @param   data, the payload, getPayloadSize() bytes available
+///     @param   length, bytes of payload
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Log::read(uint32_t seq, uint8_t data[], uint16_t *length)
+{
+    if (_lastSeq == 0 || seq < _firstSeq || seq > _lastSeq)
+        return false;
+
+    return _checkBlock(seq, data, length);
+}
+
+
+
+/*!
+///    @brief   getFirstSeq()
+///    @return  sequence number of the oldest block, 0 if the log is empty
+**/
+uint32_t FRAM_MB85RS_Log::getFirstSeq()
+{
+    return _firstSeq;
+}
+
+
+
+/*!
+///    @brief   getLastSeq()
+///    @return  sequence number of the last block, 0 if the log is empty
+**/
+uint32_t FRAM_MB85RS_Log::getLastSeq()
+{
+    return _lastSeq;
+}
+
+
+
+/*!
+///    @brief   getPayloadSize()
+///    @return  largest payload of a block
+**/
+uint16_t FRAM_MB85RS_Log::getPayloadSize()
+{
+    return (_blockSize > LOG_HEADER_SIZE) ? _blockSize - LOG_HEADER_SIZE : 0;
+}
+
+
+
+/*!
+///    @brief   getMountTime()
+///    @return  duration of the last mount(), in us
+**/
+uint32_t FRAM_MB85RS_Log::getMountTime()
+{
+    return _mountTime;
+}
+
+
+
+/*!
+///    @brief   getMountBytes()
+///    @return  bytes read from the F-RAM by the last mount()
+**/
+uint32_t FRAM_MB85RS_Log::getMountBytes()
+{
+    return _mountBytes;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _blockAddr()
+///     @return  F-RAM address of the block holding a sequence number
+**/
+uint32_t FRAM_MB85RS_Log::_blockAddr(uint32_t seq)
+{
+    return _startAddr + ((seq - 1) % _nbBlocks) * _blockSize;
+}
+
+
+
+/*!
+///     @brief   _readSeq()
+///              Read the sequence number of the block at an index
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Log::_readSeq(uint32_t index, uint32_t *seq)
+{
+    _mountBytes += 4;
+
+    return _fram.read(_startAddr + index * _blockSize, seq);
+}
+
+
+
+/*!
+///     @brief   _checkBlock()
+///              Read a block in one burst and check its header and CRC
+///     @param   seq, expected sequence number
+///     @param   data, the payload, NULL to check the block only
+///     @param   length, bytes of payload, may be NULL
+///     @return  0: error or invalid block
+///              1: ok
+**/
+boolean FRAM_MB85RS_Log::_checkBlock(uint32_t seq, uint8_t data[], uint16_t *length)
+{
+    uint8_t block[LOG_MAX_BLOCK_SIZE];
+
+    if (!_fram.readArray(_blockAddr(seq), block, _blockSize))
+        return false;
+
+    uint32_t blockSeq = (uint32_t)block[0] | ((uint32_t)block[1] << 8)
+                      | ((uint32_t)block[2] << 16) | ((uint32_t)block[3] << 24);
+    uint16_t blockLength = block[4] | (block[5] << 8);
+    uint16_t blockCrc = block[6] | (block[7] << 8);
+
+    if (blockSeq != seq || blockLength > getPayloadSize())
+        return false;
+
+    uint16_t crc = _crc16(0xFFFF, block, 6);
+    crc = _crc16(crc, &block[LOG_HEADER_SIZE], blockLength);
+
+    if (crc != blockCrc)
+        return false;
+
+    if (data != NULL)
+        memcpy(data, &block[LOG_HEADER_SIZE], blockLength);
+    if (length != NULL)
+        *length = blockLength;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _crc16()
+///              CRC-16/CCITT, polynomial 0x1021
+**/
+uint16_t FRAM_MB85RS_Log::_crc16(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+    while (length--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (uint8_t i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
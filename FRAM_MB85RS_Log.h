@@ -0,0 +1,71 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Log.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Circular append log for the MB85RS SPI FRAM series, made of fixed-size
+    blocks carrying a sequence number and a CRC. After a power loss the end
+    of the log is found with a binary search over the block headers.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_LOG_H__
+#define __FRAM_MB85RS_LOG_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+// DEFINES
+
+// Largest block size, a block is assembled on the stack before being written
+#ifndef LOG_MAX_BLOCK_SIZE
+    #define LOG_MAX_BLOCK_SIZE 256
+#endif
+
+// Block header: sequence number (32-bits), payload length (16-bits), CRC-16
+#define LOG_HEADER_SIZE 8
+
+
+class FRAM_MB85RS_Log
+{
+ public:
+    FRAM_MB85RS_Log(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint16_t blockSize, uint32_t nbBlocks);
+
+    boolean format();
+    boolean mount();
+
+    boolean append(const uint8_t data[], uint16_t length);
+    boolean read(uint32_t seq, uint8_t data[], uint16_t *length);
+
+    uint32_t getFirstSeq();
+    uint32_t getLastSeq();
+    uint16_t getPayloadSize();
+    uint32_t getMountTime();
+    uint32_t getMountBytes();
+
+
+ private:
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // F-RAM address of block 0
+    uint16_t    _blockSize;     // Bytes per block, header included
+    uint32_t    _nbBlocks;      // Number of blocks
+    uint32_t    _firstSeq;      // Oldest block still in the log, 0 when empty
+    uint32_t    _lastSeq;       // Last block appended, 0 when empty
+    uint32_t    _mountTime;     // Duration of the last mount(), in us
+    uint32_t    _mountBytes;    // Bytes read by the last mount()
+
+    uint32_t    _blockAddr(uint32_t seq);
+    boolean     _readSeq(uint32_t index, uint32_t *seq);
+    boolean     _checkBlock(uint32_t seq, uint8_t data[], uint16_t *length);
+
+    static uint16_t _crc16(uint16_t crc, const uint8_t *data, uint16_t length);
+};
+
+
+
+#endif
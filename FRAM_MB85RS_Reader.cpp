@@ -0,0 +1,335 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Reader.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Read-ahead for the MB85RS SPI FRAM series.
+
+    Reads are served from the current window. Once a read follows the
+    previous one, poll() fetches the window after the current one into
+    the second buffer, and the stream moves on to it without waiting.
+    The window doubles each time the stream moves on to a prefetched
+    window or catches up with the prefetch (a sequential read misses),
+    and halves when a prefetched window is dropped unused.
+
+    The driver has no DMA transfer, poll() is synchronous: call it when
+    the application waits anyway (radio, sensor...), the READ is then off
+    the consumer's path.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_Reader.h>
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_Reader()
+///              Constructor
+///     @param   fram, the F-RAM device
+**/
+FRAM_MB85RS_Reader::FRAM_MB85RS_Reader(FRAM_MB85RS_SPI &fram)
+    : _fram(fram)
+{
+    _buffers[0].length = 0;
+    _buffers[1].length = 0;
+    _current = 0;
+    _nextAddr = 0;
+    _streak = 0;
+    _window = READER_MIN_WINDOW;
+    _hits = 0;
+    _misses = 0;
+    _prefetches = 0;
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   read()
+///              Read a 8-bits value
+///     @param   framAddr, the memory address
+///     @param   value, the 8-bits value read
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Reader::read(uint32_t framAddr, uint8_t *value)
+{
+    return readArray(framAddr, value, 1);
+}
+
+
+
+/*!
+///     @brief   read()
+///              Read a 16-bits value
+///     @param   framAddr, the memory address
+///     @param   value, the 16-bits value read
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Reader::read(uint32_t framAddr, uint16_t *value)
+{
+    uint8_t buffer[2];
+
+    if (!readArray(framAddr, buffer, 2))
+        return false;
+
+    *value = ((uint16_t)buffer[1] << 8) + (uint16_t)buffer[0];
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   read()
+///              Read a 32-bits value
+///     @param   framAddr, the memory address
+///     @param   value, the 32-bits value read
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Reader::read(uint32_t framAddr, uint32_t *value)
+{
+    uint8_t buffer[4];
+
+    if (!readArray(framAddr, buffer, 4))
+        return false;
+
+    *value = ((uint32_t)buffer[3] << 24) + ((uint32_t)buffer[2] << 16)
+           + ((uint32_t)buffer[1] << 8) + (uint32_t)buffer[0];
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   readArray()
+///              Read an array of 8-bits values, from the buffers when
+///              possible. Reads larger than READER_BUFFER_SIZE go to the
+///              F-RAM directly for the part not buffered.
+///     @param   startAddr, the memory address to read from
+///     @param   values[], the bytes read
+///     @param   nbItems, the number of bytes
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Reader::readArray(uint32_t startAddr, uint8_t values[], size_t nbItems)
+{
+    uint32_t maxAddr = _fram.getMaxMemAdr();
+
+    if (nbItems == 0 || startAddr >= maxAddr || nbItems > maxAddr - startAddr)
+        return false;
+
+    boolean sequential = (startAddr == _nextAddr);
+    boolean hit = true;
+    size_t done = 0;
+
+    if (!sequential)
+        _streak = 0;
+    else if (_streak < 0xFF)
+        _streak++;
+
+    while (done < nbItems)
+    {
+        uint32_t addr = startAddr + done;
+        Buffer *current = &_buffers[_current];
+        Buffer *next = &_buffers[1 - _current];
+
+        if (_contains(current, addr))
+        {
+            size_t n = current->addr + current->length - addr;
+            if (n > nbItems - done)
+                n = nbItems - done;
+
+            memcpy(&values[done], &current->data[addr - current->addr], n);
+            done += n;
+            continue;
+        }
+
+        if (_contains(next, addr))
+        {
+            // The stream reached the prefetched window, fetch more next time
+            current->length = 0;
+            _current = 1 - _current;
+            if (_window * 2 <= READER_BUFFER_SIZE)
+                _window *= 2;
+            continue;
+        }
+
+        hit = false;
+
+        if (next->length != 0)
+        {
+            // Prefetched for nothing
+            next->length = 0;
+            if (_window / 2 >= READER_MIN_WINDOW)
+                _window /= 2;
+        }
+        else if (sequential && _window * 2 <= READER_BUFFER_SIZE)
+        {
+            // The stream caught up with the prefetch
+            _window *= 2;
+        }
+
+        if (nbItems - done > READER_BUFFER_SIZE)
+        {
+            if (!_fram.readArray(addr, &values[done], nbItems - done))
+                return false;
+            done = nbItems;
+        }
+        else if (!_fill(current, addr, nbItems - done))
+            return false;
+    }
+
+    _nextAddr = startAddr + nbItems;
+
+    if (hit)
+        _hits++;
+    else
+        _misses++;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   poll()
+///              Fetch the next window of a sequential stream, if not done yet
+///     @return  0: nothing fetched
+///              1: a window was fetched
+**/
+boolean FRAM_MB85RS_Reader::poll()
+{
+    Buffer *current = &_buffers[_current];
+    Buffer *next = &_buffers[1 - _current];
+
+    if (_streak == 0 || current->length == 0 || next->length != 0)
+        return false;
+
+    uint32_t addr = current->addr + current->length;
+
+    if (addr >= _fram.getMaxMemAdr() || !_fill(next, addr, 0))
+        return false;
+
+    _prefetches++;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   invalidate()
+///              Drop the buffered windows, to call after writing the range
+///              being read through the driver
+**/
+void FRAM_MB85RS_Reader::invalidate()
+{
+    _buffers[0].length = 0;
+    _buffers[1].length = 0;
+    _streak = 0;
+}
+
+
+
+/*!
+///    @brief   getHits()
+///    @return  number of reads served from the buffers only
+**/
+uint32_t FRAM_MB85RS_Reader::getHits()
+{
+    return _hits;
+}
+
+
+
+/*!
+///    @brief   getMisses()
+///    @return  number of reads which waited for a READ transaction
+**/
+uint32_t FRAM_MB85RS_Reader::getMisses()
+{
+    return _misses;
+}
+
+
+
+/*!
+///    @brief   getPrefetches()
+///    @return  number of windows fetched ahead by poll()
+**/
+uint32_t FRAM_MB85RS_Reader::getPrefetches()
+{
+    return _prefetches;
+}
+
+
+
+/*!
+///    @brief   getWindow()
+///    @return  current window size, in bytes
+**/
+uint16_t FRAM_MB85RS_Reader::getWindow()
+{
+    return _window;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _fill()
+///              Read a window into a buffer, in one READ
+///     @param   addr, address of the window
+///     @param   minLength, bytes needed at least, READER_BUFFER_SIZE at most
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Reader::_fill(Buffer *buffer, uint32_t addr, size_t minLength)
+{
+    size_t length = (_window > minLength) ? _window : minLength;
+    uint32_t left = _fram.getMaxMemAdr() - addr;
+
+    if (length > left)
+        length = left;
+
+    buffer->length = 0;
+
+    if (!_fram.readArray(addr, buffer->data, length))
+        return false;
+
+    buffer->addr = addr;
+    buffer->length = length;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   _contains()
+///     @return  1: the address is in the buffer
+**/
+boolean FRAM_MB85RS_Reader::_contains(Buffer *buffer, uint32_t addr)
+{
+    return buffer->length != 0 && addr >= buffer->addr && addr - buffer->addr < buffer->length;
+}
@@ -0,0 +1,79 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Reader.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Read-ahead for the MB85RS SPI FRAM series. Small reads are served from
+    a double buffer, the next window of a sequential stream is fetched by
+    poll() between two reads, so that the consumer does not wait for it.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_READER_H__
+#define __FRAM_MB85RS_READER_H__
+
+#include <FRAM_MB85RS_SPI.h>
+
+
+// DEFINES
+
+// Size of each of the two buffers, largest window
+#ifndef READER_BUFFER_SIZE
+    #define READER_BUFFER_SIZE 128
+#endif
+
+// Smallest window, used after random accesses
+#ifndef READER_MIN_WINDOW
+    #define READER_MIN_WINDOW 16
+#endif
+
+
+class FRAM_MB85RS_Reader
+{
+ public:
+    FRAM_MB85RS_Reader(FRAM_MB85RS_SPI &fram);
+
+    boolean read(uint32_t framAddr, uint8_t *value);
+    boolean read(uint32_t framAddr, uint16_t *value);
+    boolean read(uint32_t framAddr, uint32_t *value);
+    boolean readArray(uint32_t startAddr, uint8_t values[], size_t nbItems);
+
+    boolean poll();
+    void    invalidate();
+
+    uint32_t getHits();
+    uint32_t getMisses();
+    uint32_t getPrefetches();
+    uint16_t getWindow();
+
+
+ private:
+
+    struct Buffer
+    {
+        uint32_t    addr;                       // F-RAM address of data[0]
+        uint16_t    length;                     // Bytes valid, 0 when empty
+        uint8_t     data[READER_BUFFER_SIZE];
+    };
+
+    FRAM_MB85RS_SPI    &_fram;
+    Buffer      _buffers[2];    // Window being read, and the next one
+    uint8_t     _current;       // Index of the window being read
+    uint32_t    _nextAddr;      // Address following the last read
+    uint8_t     _streak;        // Sequential reads in a row, saturated
+    uint16_t    _window;        // Bytes per fetch
+    uint32_t    _hits;          // Reads served from the buffers only
+    uint32_t    _misses;        // Reads which waited for a READ
+    uint32_t    _prefetches;    // Windows fetched by poll()
+
+    boolean     _fill(Buffer *buffer, uint32_t addr, size_t minLength);
+    static boolean _contains(Buffer *buffer, uint32_t addr);
+};
+
+
+
+#endif
@@ -41,42 +41,61 @@
 */
 /**************************************************************************/
 
-#include <SPI.h>
 #include <FRAM_MB85RS_SPI.h>
 
+// One-byte commands, sent from flash/RAM by the transport
+static const uint8_t framOpWREN = FRAM_WREN;
+static const uint8_t framOpWRDI = FRAM_WRDI;
+static const uint8_t framOpRDID = FRAM_RDID;
+static const uint8_t framOpSLEEP = FRAM_SLEEP;
+
 /*========================================================================*/
 /*                            CONSTRUCTORS                                */
 /*========================================================================*/
 
 
+#ifdef ARDUINO
+
 /*!
 ///     @brief   FRAM_MB85RS_SPI()
-///              Constructor without write protection management
+///              Constructor without write protection management,
+///              on the hardware SPI bus
 ///     @param   cs, chip select pin - active low
 **/
 FRAM_MB85RS_SPI::FRAM_MB85RS_SPI(uint8_t cs)
+    : _spi(cs)
 {
-    _cs = cs;
+    _bus = &_spi;
+    _nbSegments = 0;
     _wp = false; // No WP pin connected, WP management inactive
     
-    _csCONFIG();
-    _csRELEASE();
-    delay(50);
-    
     _framInitialised = false;
+    _state = FRAM_STATE_IDLE;
+    _trustDensity = false;
+    _maxaddress = 0;
+    _initTime = 0;
+    _sleepTimeout = 0;
+    _sleeping = false;
+    _sleepTime = 0;
+    _sleepTimeUs = 0;
+    _wakeCount = 0;
+    _wakeTime = 0;
 }
 
 
 
 /*!
 ///     @brief   FRAM_MB85RS_SPI()
-///              Constructor with write protection pin
+///              Constructor with write protection pin,
+///              on the hardware SPI bus
 ///     @param   cs, chip select pin - active low
 ///     @param   wp, write protected pin - active low
 **/
 FRAM_MB85RS_SPI::FRAM_MB85RS_SPI(uint8_t cs, uint8_t wp)
+    : _spi(cs)
 {
-    _cs = cs;
+    _bus = &_spi;
+    _nbSegments = 0;
 
     _wp = true; // WP pin connected and Write Protection enabled
     _wpPin = wp;
@@ -84,11 +103,294 @@ FRAM_MB85RS_SPI::FRAM_MB85RS_SPI(uint8_t cs, uint8_t wp)
     // The init WP management status is define under DEFAULT_WP_STATUS
     DEFAULT_WP_STATUS ? enableWP() : disableWP();
     
-    _csCONFIG();
-    _csRELEASE();
-    delay(50);
+    _framInitialised = false;
+    _state = FRAM_STATE_IDLE;
+    _trustDensity = false;
+    _maxaddress = 0;
+    _initTime = 0;
+    _sleepTimeout = 0;
+    _sleeping = false;
+    _sleepTime = 0;
+    _sleepTimeUs = 0;
+    _wakeCount = 0;
+    _wakeTime = 0;
+}
+
+#endif
+
+
+
+/*!
+///     @brief   FRAM_MB85RS_SPI()
+///              Constructor on any transport: bit-banged pins, simulator,
+///              Linux spidev...
+///     @param   transport, the bus access, begun by begin()
+**/
+FRAM_MB85RS_SPI::FRAM_MB85RS_SPI(FRAM_MB85RS_Transport &transport)
+#ifdef ARDUINO
+    : _spi(FRAM_NO_PIN)
+#endif
+{
+    _bus = &transport;
+    _nbSegments = 0;
+    _wp = false; // No WP pin connected, WP management inactive
     
     _framInitialised = false;
+    _state = FRAM_STATE_IDLE;
+    _trustDensity = false;
+    _maxaddress = 0;
+    _initTime = 0;
+    _sleepTimeout = 0;
+    _sleeping = false;
+    _sleepTime = 0;
+    _sleepTimeUs = 0;
+    _wakeCount = 0;
+    _wakeTime = 0;
+}
+
+
+
+/*========================================================================*/
+/*                          REDUCTION KERNELS                             */
+/*========================================================================*/
+
+// Values are stored little-endian, as written by write() and writeArray()
+static inline int16_t framLoadInt16(const uint8_t *p)
+{
+    return (int16_t)((uint16_t)p[0] | ((uint16_t)p[1] << 8));
+}
+
+static inline int32_t framLoadInt32(const uint8_t *p)
+{
+    return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline float framLoadFloat(const uint8_t *p)
+{
+    uint32_t w = (uint32_t)framLoadInt32(p);
+    float f;
+    memcpy(&f, &w, 4);
+    return f;
+}
+
+static uint8_t framItemSize(uint8_t type)
+{
+    switch (type)
+    {
+        case FRAM_TYPE_UINT8: return 1;
+        case FRAM_TYPE_INT16: return 2;
+        case FRAM_TYPE_INT32:
+        case FRAM_TYPE_FLOAT: return 4;
+        default: return 0;
+    }
+}
+
+
+struct FramStatsState
+{
+    uint8_t     type;
+    uint32_t    count;
+    int64_t     isum;
+    int32_t     imin, imax;
+    double      fsum;
+    float       fmin, fmax;
+};
+
+static boolean framStatsConsumer(const uint8_t *data, size_t length, void *context)
+{
+    FramStatsState *st = (FramStatsState *)context;
+    size_t i = 0;
+    
+    switch (st->type)
+    {
+        case FRAM_TYPE_UINT8:
+        {
+            // Sum 4 bytes per step in two 16-bits lanes, folded every 64 words
+            while (i + 4 <= length)
+            {
+                uint32_t lanes = 0;
+                for (uint8_t w = 0; w < 64 && i + 4 <= length; w++, i += 4)
+                {
+                    uint32_t word;
+                    memcpy(&word, &data[i], 4);
+                    lanes += (word & 0x00FF00FF) + ((word >> 8) & 0x00FF00FF);
+                }
+                st->isum += (lanes & 0xFFFF) + (lanes >> 16);
+            }
+            for (; i < length; i++)
+                st->isum += data[i];
+            
+            for (i = 0; i < length; i++)
+            {
+                if (data[i] < st->imin) st->imin = data[i];
+                if (data[i] > st->imax) st->imax = data[i];
+            }
+            st->count += length;
+            break;
+        }
+        
+        case FRAM_TYPE_INT16:
+            for (; i + 2 <= length; i += 2)
+            {
+                int16_t v = framLoadInt16(&data[i]);
+                st->isum += v;
+                if (v < st->imin) st->imin = v;
+                if (v > st->imax) st->imax = v;
+            }
+            st->count += length / 2;
+            break;
+        
+        case FRAM_TYPE_INT32:
+            for (; i + 4 <= length; i += 4)
+            {
+                int32_t v = framLoadInt32(&data[i]);
+                st->isum += v;
+                if (v < st->imin) st->imin = v;
+                if (v > st->imax) st->imax = v;
+            }
+            st->count += length / 4;
+            break;
+        
+        case FRAM_TYPE_FLOAT:
+            for (; i + 4 <= length; i += 4)
+            {
+                float v = framLoadFloat(&data[i]);
+                st->fsum += v;
+                if (v < st->fmin) st->fmin = v;
+                if (v > st->fmax) st->fmax = v;
+            }
+            st->count += length / 4;
+            break;
+    }
+    
+    return true;
+}
+
+
+struct FramHistogramState
+{
+    uint8_t     type;
+    float       low, high, scale;
+    uint32_t   *bins;
+    uint16_t    nbBins;
+};
+
+static boolean framHistogramConsumer(const uint8_t *data, size_t length, void *context)
+{
+    FramHistogramState *st = (FramHistogramState *)context;
+    uint8_t size = framItemSize(st->type);
+    
+    for (size_t i = 0; i + size <= length; i += size)
+    {
+        float v;
+        switch (st->type)
+        {
+            case FRAM_TYPE_UINT8: v = data[i]; break;
+            case FRAM_TYPE_INT16: v = framLoadInt16(&data[i]); break;
+            case FRAM_TYPE_INT32: v = framLoadInt32(&data[i]); break;
+            default:              v = framLoadFloat(&data[i]); break;
+        }
+        
+        // Items out of [low, high) are not counted
+        if (v >= st->low && v < st->high)
+        {
+            uint16_t bin = (uint16_t)((v - st->low) * st->scale);
+            st->bins[bin < st->nbBins ? bin : st->nbBins - 1]++;
+        }
+    }
+    
+    return true;
+}
+
+
+struct FramCountState
+{
+    uint8_t     type;
+    uint8_t     op;
+    int64_t     lo, hi;     // Integer items: counted when lo <= item <= hi
+    boolean     negate;     // Integer items: count the items out of [lo, hi]
+    float       threshold;  // Float items
+    uint32_t    count;
+};
+
+static boolean framCountConsumer(const uint8_t *data, size_t length, void *context)
+{
+    FramCountState *st = (FramCountState *)context;
+    size_t i = 0;
+    uint32_t n = 0;
+    
+    switch (st->type)
+    {
+        case FRAM_TYPE_UINT8:
+            for (; i < length; i++)
+                n += (data[i] >= st->lo && data[i] <= st->hi) ^ st->negate;
+            break;
+        
+        case FRAM_TYPE_INT16:
+            for (; i + 2 <= length; i += 2)
+            {
+                int16_t v = framLoadInt16(&data[i]);
+                n += (v >= st->lo && v <= st->hi) ^ st->negate;
+            }
+            break;
+        
+        case FRAM_TYPE_INT32:
+            for (; i + 4 <= length; i += 4)
+            {
+                int32_t v = framLoadInt32(&data[i]);
+                n += (v >= st->lo && v <= st->hi) ^ st->negate;
+            }
+            break;
+        
+        case FRAM_TYPE_FLOAT:
+            for (; i + 4 <= length; i += 4)
+            {
+                float v = framLoadFloat(&data[i]);
+                switch (st->op)
+                {
+                    case FRAM_CMP_LT: n += (v <  st->threshold); break;
+                    case FRAM_CMP_LE: n += (v <= st->threshold); break;
+                    case FRAM_CMP_GT: n += (v >  st->threshold); break;
+                    case FRAM_CMP_GE: n += (v >= st->threshold); break;
+                    case FRAM_CMP_EQ: n += (v == st->threshold); break;
+                    default:          n += (v != st->threshold); break;
+                }
+            }
+            break;
+    }
+    
+    st->count += n;
+    
+    return true;
+}
+
+
+
+/*========================================================================*/
+/*                          STREAM PRODUCERS                              */
+/*========================================================================*/
+
+static void framFillProducer(uint8_t *data, size_t length, void *context)
+{
+    memset(data, *(uint8_t *)context, length);
+}
+
+
+struct FramWords16
+{
+    const uint16_t *values;     // Next item to send
+};
+
+static void framWords16Producer(uint8_t *data, size_t length, void *context)
+{
+    FramWords16 *st = (FramWords16 *)context;
+    
+    // Stored little-endian, as write() does
+    for (size_t i = 0; i + 2 <= length; i += 2, st->values++)
+    {
+        data[i] = *st->values & 0xFF;
+        data[i + 1] = *st->values >> 8;
+    }
 }
 
 
@@ -100,20 +402,21 @@ FRAM_MB85RS_SPI::FRAM_MB85RS_SPI(uint8_t cs, uint8_t wp)
 
 /*!
 ///     @brief   init()
-///              Inititalize the F-RAM chip
+///              Inititalize the F-RAM chip, waiting only for the remaining
+///              power-up time. Serial is never started nor waited for.
 ///     @return  if DEBUG_TRACE, provides all the informations on the chip
+///              when Serial has been started by the sketch
 **/
 void FRAM_MB85RS_SPI::init()
 {
-    SPISettings(SPICONFIG);
-    SPI.begin();
+    if (_state == FRAM_STATE_IDLE)
+        begin();
     
-    boolean deviceFound = checkDevice();
+    while (poll() == FRAM_STATE_POWERUP) {}
     
 #if defined(DEBUG_TRACE) || defined(CHIP_TRACE)
     if (!Serial)
-        Serial.begin(115200);
-    while (!Serial) {}
+        return;
     
     Serial.println("FRAM_MB85RS_SPI created\n");
     Serial.print("Write protect management: ");
@@ -122,7 +425,7 @@ void FRAM_MB85RS_SPI::init()
     else
         Serial.println("inactive");
     
-    if (deviceFound)
+    if (_framInitialised)
     {
         Serial.println("Memory Chip initialized");
         _deviceID2Serial();
@@ -134,6 +437,216 @@ void FRAM_MB85RS_SPI::init()
 
 
 
+/*!
+///     @brief   begin()
+///              Start the initialization without blocking.
+///              The device is identified by poll() once the power-up time
+///              is elapsed, or on its first access.
+///              Several devices can be started one after the other and
+///              then polled together, their power-up times overlap.
+///     @note    tPU is counted from the MCU reset, a sketch which calls
+///              begin() after FRAM_POWERUP_US does not wait at all.
+///              A device put into sleep mode before this begin() gets its
+///              wake-up pulse here, poll() waits the recovery time.
+**/
+void FRAM_MB85RS_SPI::begin()
+{
+    _framInitialised = false;
+    _trustDensity = false;
+    _beginTime = framMicros();
+    _powerupWait = (_beginTime < FRAM_POWERUP_US) ? FRAM_POWERUP_US - _beginTime : 0;
+    _state = _bus->begin() ? FRAM_STATE_POWERUP : FRAM_STATE_ERROR;
+    
+    if (_sleeping && _state == FRAM_STATE_POWERUP)
+    {
+        if (!_wakePulse())
+            _state = FRAM_STATE_ERROR;
+        else if (_powerupWait < FRAM_RECOVERY_US)
+            _powerupWait = FRAM_RECOVERY_US;
+    }
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Start the initialization of a known device without blocking,
+///              the Device ID is not read
+///     @param   densitycode, DENSITY_MB85RSxxx code of the device
+///     @note    An unknown density code falls back on the Device ID
+**/
+void FRAM_MB85RS_SPI::begin(uint8_t densitycode)
+{
+    begin();
+    
+    if (_setGeometry(densitycode))
+    {
+        _manufacturer = FUJITSU_ID;
+        _productID = 0;
+        _trustDensity = true;
+    }
+}
+
+
+
+/*!
+///     @brief   poll()
+///              Move the initialization forward, and put the device into
+///              sleep mode once idle for the time set by setSleepTimeout().
+///              Never blocks.
+///     @return  FRAM_STATE_IDLE: begin() not called
+///              FRAM_STATE_POWERUP: power-up time not elapsed
+///              FRAM_STATE_READY: device ready
+///              FRAM_STATE_ERROR: device not found
+**/
+uint8_t FRAM_MB85RS_SPI::poll()
+{
+    if (_state == FRAM_STATE_POWERUP
+        && (uint32_t)(framMicros() - _beginTime) >= _powerupWait)
+    {
+        if (_trustDensity)
+        {
+            _framInitialised = true;
+            _state = FRAM_STATE_READY;
+        }
+        else
+            checkDevice();
+        
+        _initTime = framMicros() - _beginTime;
+        _lastAccess = framMicros();
+    }
+    
+    if (_state == FRAM_STATE_READY && _sleepTimeout != 0)
+    {
+        if (_sleeping)
+            _countSleepTime();
+        else if ((uint32_t)(framMicros() - _lastAccess) >= _sleepTimeout)
+            sleep();
+    }
+    
+    return _state;
+}
+
+
+
+/*!
+///     @brief   isReady()
+///     @return  0: not ready yet, or device not found
+///              1: device ready
+**/
+boolean FRAM_MB85RS_SPI::isReady()
+{
+    return poll() == FRAM_STATE_READY;
+}
+
+
+
+/*!
+///     @brief   getInitTime()
+///              Time from begin() to the end of the initialization
+///     @return  time in us, 0 while not initialized
+**/
+uint32_t FRAM_MB85RS_SPI::getInitTime()
+{
+    return _initTime;
+}
+
+
+
+/*!
+///     @brief   setSleepTimeout()
+///              Enter sleep mode after an idle time, checked by poll().
+///              Each access restarts the idle time, so the device stays
+///              awake during bursts of accesses.
+///     @param   idleTime, in us, 0 never sleeps (default)
+///     @note    The first access after sleep waits FRAM_RECOVERY_US,
+///              see getWakeTime()
+**/
+void FRAM_MB85RS_SPI::setSleepTimeout(uint32_t idleTime)
+{
+    _sleepTimeout = idleTime;
+}
+
+
+
+/*!
+///     @brief   sleep()
+///              Enter sleep mode now, the next access wakes the device up
+///     @return  0: error, device not ready
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::sleep()
+{
+    if (!_framInitialised)
+        return false;
+    
+    if (_sleeping)
+        return true;
+    
+    if ( !_push(&framOpSLEEP, NULL, 1, true)
+        || !_submit() )
+        return false;
+    
+    _sleeping = true;
+    _sleepMark = framMicros();
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   isSleeping()
+///     @return  0: device awake
+///              1: device in sleep mode
+**/
+boolean FRAM_MB85RS_SPI::isSleeping()
+{
+    return _sleeping;
+}
+
+
+
+/*!
+///     @brief   getSleepTime()
+///              Time spent in sleep mode since the start, counted by
+///              poll() too, call it at least every 70 minutes while
+///              sleeping (framMicros() wraps)
+///     @return  time in ms
+**/
+uint32_t FRAM_MB85RS_SPI::getSleepTime()
+{
+    if (_sleeping)
+        _countSleepTime();
+    
+    return _sleepTime;
+}
+
+
+
+/*!
+///     @brief   getWakeCount()
+///     @return  number of wake-ups from sleep mode
+**/
+uint32_t FRAM_MB85RS_SPI::getWakeCount()
+{
+    return _wakeCount;
+}
+
+
+
+/*!
+///     @brief   getWakeTime()
+///              Latency added to the accesses by the wake-ups
+///     @return  total time in us, divide by getWakeCount() for the average
+**/
+uint32_t FRAM_MB85RS_SPI::getWakeTime()
+{
+    return _wakeTime;
+}
+
+
+
 /*!
 ///     @brief   checkDevice()
 ///              Check if the device is connected
@@ -147,10 +660,12 @@ boolean FRAM_MB85RS_SPI::checkDevice()
 	if (result && _manufacturer == FUJITSU_ID && _maxaddress != 0)
     {
 		_framInitialised = true;
+        _state = FRAM_STATE_READY;
         return true;
 	}
     
     _framInitialised = false;
+    _state = FRAM_STATE_ERROR;
     return false;
 }
 
@@ -166,7 +681,7 @@ boolean FRAM_MB85RS_SPI::checkDevice()
 **/
 boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint8_t *value )
 {
-    if (framAddr >= _maxaddress || !_framInitialised)
+    if (!_ensureReady() || framAddr >= _maxaddress)
         return false;
     
 //#ifdef DEBUG_TRACE
@@ -174,13 +689,9 @@ boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint8_t *value )
 //    Serial.println(framAddr, BIN);
 //#endif
     
-    _csASSERT();
-        // Read byte operation
-        SPI.transfer(FRAM_READ);
-        _setMemAddr(&framAddr);
-        // Read value
-        *value = SPI.transfer(0);
-    _csRELEASE();
+    // Read byte operation
+    if (!_access(FRAM_READ, framAddr, NULL, value, 1))
+        return false;
     
     _lastaddress = framAddr+1;
     
@@ -199,19 +710,14 @@ boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint8_t *value )
 **/
 boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint16_t *value )
 {
-    if (framAddr >= _maxaddress || !_framInitialised)
+    if (!_ensureReady() || framAddr >= _maxaddress)
         return false;
     
     uint8_t buffer[2];
     
-    _csASSERT();
-        // Read byte operation
-        SPI.transfer(FRAM_READ);
-        _setMemAddr(&framAddr);
-        // Read value
-        buffer[0] = SPI.transfer(0);
-        buffer[1] = SPI.transfer(0);
-    _csRELEASE();
+    // Read byte operation
+    if (!_access(FRAM_READ, framAddr, NULL, buffer, 2))
+        return false;
     
     *value = ((uint16_t) buffer[1] << 8) + (uint16_t)buffer[0];
     
@@ -232,23 +738,16 @@ boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint16_t *value )
 **/
 boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint32_t *value )
 {
-    if (framAddr >= _maxaddress || !_framInitialised)
+    if (!_ensureReady() || framAddr >= _maxaddress)
         return false;
     
     uint8_t buffer[4];
     
-    _csASSERT();
-        // Read byte operation
-        SPI.transfer(FRAM_READ);
-        _setMemAddr(&framAddr);
-        // Read value
-        buffer[0] = SPI.transfer(0);
-        buffer[1] = SPI.transfer(0);
-        buffer[2] = SPI.transfer(0);
-        buffer[3] = SPI.transfer(0);
-    _csRELEASE();
+    // Read byte operation
+    if (!_access(FRAM_READ, framAddr, NULL, buffer, 4))
+        return false;
    
-    *value = ( (uint32_t)buffer[3] << 24) + (uint32_t)buffer[2] << 16) + ((uint32_t)buffer[1] << 8) + (uint32_t)buffer[0];
+    *value = ((uint32_t)buffer[3] << 24) + ((uint32_t)buffer[2] << 16) + ((uint32_t)buffer[1] << 8) + (uint32_t)buffer[0];
     
     _lastaddress = framAddr+4;
     
@@ -267,26 +766,12 @@ boolean FRAM_MB85RS_SPI::read( uint32_t framAddr, uint32_t *value )
 **/
 boolean FRAM_MB85RS_SPI::write( uint32_t framAddr, uint8_t value )
 {
-    if (value > 0xFF || framAddr >= _maxaddress || !_framInitialised)
+    if (value > 0xFF || !_ensureReady() || framAddr >= _maxaddress)
         return false;
     
-    // Set Memory Write Enable Latch, otherwise no Write can be achieve
-    _csASSERT();
-        SPI.transfer(FRAM_WREN);
-    _csRELEASE();
-    
-    // Write byte operation
-    _csASSERT();
-        SPI.transfer(FRAM_WRITE);
-        _setMemAddr(&framAddr);
-        // Write value
-        SPI.transfer(value);
-    _csRELEASE();
-    
-    // Reset Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WRDI);
-    _csRELEASE();
+    // Write byte operation, between WREN and WRDI
+    if (!_access(FRAM_WRITE, framAddr, &value, NULL, 1))
+        return false;
     
     _lastaddress = framAddr+1;
     
@@ -305,27 +790,14 @@ boolean FRAM_MB85RS_SPI::write( uint32_t framAddr, uint8_t value )
 **/
 boolean FRAM_MB85RS_SPI::write( uint32_t framAddr, uint16_t value )
 {
-    if (value > 0xFFFF || framAddr >= _maxaddress || !_framInitialised)
+    if (value > 0xFFFF || !_ensureReady() || framAddr >= _maxaddress)
         return false;
     
-    // Set Memory Write Enable Latch, otherwise no Write can be achieve
-    _csASSERT();
-        SPI.transfer(FRAM_WREN);
-    _csRELEASE();
-    
-    // Write byte operation
-    _csASSERT();
-        SPI.transfer(FRAM_WRITE);
-        _setMemAddr(&framAddr);
-        // Write value
-        SPI.transfer(value);
-        SPI.transfer((value >> 8) & 0xFF);
-    _csRELEASE();
+    uint8_t buffer[2] = { (uint8_t)(value & 0xFF), (uint8_t)(value >> 8) };
     
-    // Reset Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WRDI);
-    _csRELEASE();
+    // Write byte operation, between WREN and WRDI
+    if (!_access(FRAM_WRITE, framAddr, buffer, NULL, 2))
+        return false;
     
     _lastaddress = framAddr+2;
     
@@ -344,29 +816,15 @@ boolean FRAM_MB85RS_SPI::write( uint32_t framAddr, uint16_t value )
 **/
 boolean FRAM_MB85RS_SPI::write( uint32_t framAddr, uint32_t value )
 {
-    if (value > 0xFFFFFFFF || framAddr >= _maxaddress || !_framInitialised)
+    if (value > 0xFFFFFFFF || !_ensureReady() || framAddr >= _maxaddress)
         return false;
     
-    // Set Memory Write Enable Latch, otherwise no Write can be achieve
-    _csASSERT();
-        SPI.transfer(FRAM_WREN);
-    _csRELEASE();
-    
-    // Write byte operation
-    _csASSERT();
-        SPI.transfer(FRAM_WRITE);
-        _setMemAddr(&framAddr);
-        // Write value
-        SPI.transfer(value & 0xFF);
-        SPI.transfer((value & 0xFFFF) >> 8);
-        SPI.transfer((value & 0xFFFFFF) >> 16);
-        SPI.transfer(value >> 24);
-    _csRELEASE();
- 
-    // Reset Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WRDI);
-    _csRELEASE();
+    uint8_t buffer[4] = { (uint8_t)(value & 0xFF), (uint8_t)((value >> 8) & 0xFF),
+                          (uint8_t)((value >> 16) & 0xFF), (uint8_t)(value >> 24) };
+    
+    // Write byte operation, between WREN and WRDI
+    if (!_access(FRAM_WRITE, framAddr, buffer, NULL, 4))
+        return false;
     
     _lastaddress = framAddr+4;
     
@@ -387,28 +845,23 @@ boolean FRAM_MB85RS_SPI::write( uint32_t framAddr, uint32_t value )
 **/
 boolean FRAM_MB85RS_SPI::readArray( uint32_t startAddr, uint8_t values[], size_t nbItems )
 {
-    if ( startAddr >= _maxaddress
+    if ( !_ensureReady()
+        || startAddr >= _maxaddress
         || ((startAddr + nbItems - 1) >= _maxaddress)
-        || nbItems == 0
-        || !_framInitialised )
+        || nbItems == 0 )
         return false;
     
-    _csASSERT();
-    // Read byte operation
-    SPI.transfer(FRAM_READ);
-    _setMemAddr(&startAddr);
+    // Read values in one block transfer
+    if (!_access(FRAM_READ, startAddr, NULL, values, nbItems))
+        return false;
     
-    // Read values
+#ifdef DEBUG_TRACE
     for (uint32_t i = 0; i < nbItems; i++)
     {
-        values[i] = SPI.transfer(0);
-#ifdef DEBUG_TRACE
         Serial.print("Adr 0x"); Serial.print(startAddr+i, HEX);
         Serial.print(", Value[");Serial.print(i); Serial.print("] = 0x"); Serial.println(values[i], HEX);
-#endif
     }
-    
-    _csRELEASE();
+#endif
     
     _lastaddress = startAddr + nbItems - 1;
     
@@ -429,32 +882,27 @@ boolean FRAM_MB85RS_SPI::readArray( uint32_t startAddr, uint8_t values[], size_t
  **/
 boolean FRAM_MB85RS_SPI::readArray( uint32_t startAddr, uint16_t values[], size_t nbItems )
 {
-    if ( startAddr >= _maxaddress
+    if ( !_ensureReady()
+        || startAddr >= _maxaddress
         || ((startAddr + (nbItems*2) - 2) >= _maxaddress)
-        || nbItems == 0
-        || !_framInitialised )
+        || nbItems == 0 )
         return false;
     
-    uint8_t buffer[2];
+    uint8_t *buffer = (uint8_t *)values;
+    
+    // Read values in one block transfer, then from little-endian in place
+    if (!_access(FRAM_READ, startAddr, NULL, buffer, nbItems * 2))
+        return false;
     
-    _csASSERT();
-        // Read byte operation
-        SPI.transfer(FRAM_READ);
-        _setMemAddr(&startAddr);
+    for (uint32_t i = 0; i < nbItems; i++)
+    {
+        values[i] = ((uint16_t) buffer[2*i+1] << 8) + (uint16_t)buffer[2*i];
         
-        // Read values
-        for (uint32_t i = 0; i < nbItems; i++)
-        {
-            buffer[0] = SPI.transfer(0);
-            buffer[1] = SPI.transfer(0);
-            values[i] = ((uint16_t) buffer[1] << 8) + (uint16_t)buffer[0];
-            
 #ifdef DEBUG_TRACE
-            Serial.print("Adr 0x"); Serial.print(startAddr+(i*2), HEX);
-            Serial.print(", Value[");Serial.print(i); Serial.print("] = 0x"); Serial.println(values[i], HEX);
+        Serial.print("Adr 0x"); Serial.print(startAddr+(i*2), HEX);
+        Serial.print(", Value[");Serial.print(i); Serial.print("] = 0x"); Serial.println(values[i], HEX);
 #endif
-        }
-    _csRELEASE();
+    }
     
     _lastaddress = startAddr + (nbItems*2) - 2;
     
@@ -475,30 +923,15 @@ boolean FRAM_MB85RS_SPI::readArray( uint32_t startAddr, uint16_t values[], size_
 **/
 boolean FRAM_MB85RS_SPI::writeArray( uint32_t startAddr, uint8_t values[], size_t nbItems )
 {
-    if ( startAddr >= _maxaddress
+    if ( !_ensureReady()
+        || startAddr >= _maxaddress
         || ((startAddr + nbItems - 1) >= _maxaddress)
-        || nbItems == 0
-        || !_framInitialised )
+        || nbItems == 0 )
         return false;
     
-    // Set Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WREN);
-    _csRELEASE();
-    
-    // Write byte operation
-    _csASSERT();
-        SPI.transfer(FRAM_WRITE);
-        _setMemAddr(&startAddr);
-        // Write values
-        for (uint32_t i = 0; i < nbItems; i++)
-            SPI.transfer(values[i]);
-    _csRELEASE();
-    
-    // Reset Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WRDI);
-    _csRELEASE();
+    // Write values in one block transfer, between WREN and WRDI
+    if (!_access(FRAM_WRITE, startAddr, values, NULL, nbItems))
+        return false;
     
     _lastaddress = startAddr + nbItems - 1;
     
@@ -519,34 +952,16 @@ boolean FRAM_MB85RS_SPI::writeArray( uint32_t startAddr, uint8_t values[], size_
  **/
 boolean FRAM_MB85RS_SPI::writeArray( uint32_t startAddr, uint16_t values[], size_t nbItems )
 {
-    if ( startAddr >= _maxaddress
+    if ( !_ensureReady()
+        || startAddr >= _maxaddress
         || ((startAddr + (nbItems*2) - 2) >= _maxaddress)
-        || nbItems == 0
-        || !_framInitialised )
+        || nbItems == 0 )
         return false;
     
-    // Set Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WREN);
-    _csRELEASE();
-    
-    // Write byte operation
-    _csASSERT();
-        SPI.transfer(FRAM_WRITE);
-        _setMemAddr(&startAddr);
-        
-        // Write values
-        for (uint32_t i = 0; i < nbItems; i++)
-        {
-            SPI.transfer(values[i]);
-            SPI.transfer((values[i] >> 8) & 0xFF);
-        }
-    _csRELEASE();
-    
-    // Reset Memory Write Enable Latch
-    _csASSERT();
-        SPI.transfer(FRAM_WRDI);
-    _csRELEASE();
+    // Write values as little-endian bytes, in one transaction
+    FramWords16 words = { values };
+    if (!_writeStream(startAddr, nbItems * 2, framWords16Producer, &words))
+        return false;
     
     _lastaddress = startAddr + (nbItems*2) - 2;
     
@@ -556,14 +971,465 @@ boolean FRAM_MB85RS_SPI::writeArray( uint32_t startAddr, uint16_t values[], size
 
 
 /*!
-///    @brief   isAvailable()
-///             Returns the readiness of the memory chip
-///    @return  0: ready
-///             1: unavailable
-**/
+///     @brief   fillArray()
+///              Write the same 8-bits value over a range in one burst,
+///              no buffer needed
+///     @param   startAddr, the memory address to write from
+///     @param   value, the 8-bits value to write
+///     @param   nbItems, the number of bytes to write
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::fillArray( uint32_t startAddr, uint8_t value, size_t nbItems )
+{
+    if ( !_ensureReady()
+        || startAddr >= _maxaddress
+        || ((startAddr + nbItems - 1) >= _maxaddress)
+        || nbItems == 0 )
+        return false;
+    
+    // Write values in one transaction
+    if (!_writeStream(startAddr, nbItems, framFillProducer, &value))
+        return false;
+    
+    _lastaddress = startAddr + nbItems - 1;
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   gather()
+///              Read a list of scattered ranges with as few READ transactions
+///              as possible. Requests are sorted by address and merged when
+///              the gap between them is cheaper to clock through than a new
+///              transaction (opcode + address + FRAM_CS_OVERHEAD bytes).
+///              Bytes are clocked straight into their destinations.
+///     @param   requests[], the ranges to read, sorted in place
+///     @param   nbRequests, the number of requests
+///     @return  the number of READ transactions issued, 0 on error
+///     @note    Overlapping requests are allowed, the shared bytes are
+///              copied from the request that read them first
+///     @note    The transactions go to the transport FRAM_MAX_SEGMENTS
+///              segments at a time, a long list takes several calls
+**/
+uint16_t FRAM_MB85RS_SPI::gather( FRAM_MB85RS_Gather requests[], uint16_t nbRequests )
+{
+    if ( !_ensureReady() || nbRequests == 0 )
+        return 0;
+    
+    for (uint16_t i = 0; i < nbRequests; i++)
+        if ( requests[i].length == 0
+            || requests[i].addr >= _maxaddress
+            || requests[i].length > _maxaddress - requests[i].addr )
+            return 0;
+    
+    // Sort by address, lists are short
+    for (uint16_t i = 1; i < nbRequests; i++)
+    {
+        FRAM_MB85RS_Gather request = requests[i];
+        uint16_t j = i;
+        while (j > 0 && requests[j-1].addr > request.addr)
+        {
+            requests[j] = requests[j-1];
+            j--;
+        }
+        requests[j] = request;
+    }
+    
+    uint32_t threshold = 1 + ((_densitycode >= DENSITY_MB85RS1MT) ? 3 : 2) + FRAM_CS_OVERHEAD;
+    uint16_t transactions = 0;
+    uint16_t first = 0;
+    
+    while (first < nbRequests)
+    {
+        // Merge the following requests while the gap is cheaper than a new READ,
+        // a gap of exactly opcode + address + overhead costs the same and is not read
+        uint32_t end = requests[first].addr + requests[first].length;
+        uint16_t last = first + 1;
+        
+        while (last < nbRequests && requests[last].addr < end + threshold)
+        {
+            uint32_t lastEnd = requests[last].addr + requests[last].length;
+            if (lastEnd > end)
+                end = lastEnd;
+            last++;
+        }
+        
+        // Read byte operation, the gaps are clocked and discarded
+        uint32_t pos = requests[first].addr;
+        
+        if (!_pushCommand(FRAM_READ, pos))
+            return 0;
+        
+        for (uint16_t k = first; k < last; k++)
+        {
+            uint32_t reqAddr = requests[k].addr;
+            uint32_t reqEnd = reqAddr + requests[k].length;
+            uint8_t *dest = (uint8_t *)requests[k].dest;
+            
+            if (reqAddr > pos && !_push(NULL, NULL, reqAddr - pos, false))
+                return 0;
+            
+            if (reqEnd > pos)
+            {
+                uint32_t from = (reqAddr > pos) ? reqAddr : pos;
+                if (!_push(NULL, &dest[from - reqAddr], reqEnd - from, false))
+                    return 0;
+                pos = reqEnd;
+            }
+        }
+        
+        // The transaction ends with its last segment
+        _segments[_nbSegments - 1].csRelease = true;
+        
+        _lastaddress = end;
+        transactions++;
+        first = last;
+    }
+    
+    // Send what _push() has not sent yet
+    if (!_submit())
+        return 0;
+    
+    // Bytes shared with previous requests of the same transaction
+    // were only clocked once, copy them now
+    first = 0;
+    while (first < nbRequests)
+    {
+        uint32_t pos = requests[first].addr;
+        uint16_t k = first;
+        
+        do
+        {
+            uint32_t reqAddr = requests[k].addr;
+            uint32_t reqEnd = reqAddr + requests[k].length;
+            uint8_t *dest = (uint8_t *)requests[k].dest;
+            
+            if (reqAddr < pos)
+            {
+                uint32_t overlapEnd = (reqEnd < pos) ? reqEnd : pos;
+                for (uint16_t j = first; j < k; j++)
+                {
+                    uint32_t from = (reqAddr > requests[j].addr) ? reqAddr : requests[j].addr;
+                    uint32_t to = requests[j].addr + requests[j].length;
+                    if (to > overlapEnd)
+                        to = overlapEnd;
+                    if (from < to)
+                        memcpy(&dest[from - reqAddr],
+                               &((uint8_t *)requests[j].dest)[from - requests[j].addr], to - from);
+                }
+            }
+            
+            if (reqEnd > pos)
+                pos = reqEnd;
+            k++;
+        }
+        while (k < nbRequests && requests[k].addr < pos + threshold);
+        
+        first = k;
+    }
+    
+    return transactions;
+}
+
+
+
+/*!
+///     @brief   copy()
+///              Copy a range of the F-RAM to another address of the chip
+///     @param   dstAddr, the address to copy to
+///     @param   srcAddr, the address to copy from
+///     @param   nbItems, the number of bytes to copy
+///     @return  0: error, out of the memory or overlapping ranges (use move())
+///              1: ok
+///     @note    Data goes through the MCU by chunks of FRAM_COPY_CHUNK bytes.
+///              Read and write of a chunk share the bus and the CS line of
+///              the chip and cannot overlap, the copy runs at about half the
+///              SPI clock once the chunks amortize the transaction overhead.
+**/
+boolean FRAM_MB85RS_SPI::copy( uint32_t dstAddr, uint32_t srcAddr, size_t nbItems )
+{
+    if ( !_ensureReady()
+        || nbItems == 0
+        || srcAddr >= _maxaddress || nbItems > _maxaddress - srcAddr
+        || dstAddr >= _maxaddress || nbItems > _maxaddress - dstAddr )
+        return false;
+    
+    // Both ranges are in the chip, the distances cannot wrap
+    if ( (dstAddr < srcAddr && srcAddr - dstAddr < nbItems)
+        || (srcAddr < dstAddr && dstAddr - srcAddr < nbItems) )
+        return false;
+    
+    return move(dstAddr, srcAddr, nbItems);
+}
+
+
+
+/*!
+///     @brief   move()
+///              Move a range of the F-RAM, overlapping ranges are allowed
+///     @param   dstAddr, the address to move to
+///     @param   srcAddr, the address to move from
+///     @param   nbItems, the number of bytes to move
+///     @return  0: error, out of the memory
+///              1: ok
+///     @note    Chunks are moved from the end when the destination is
+///              after an overlapping source, so that no byte is overwritten
+///              before it is read
+**/
+boolean FRAM_MB85RS_SPI::move( uint32_t dstAddr, uint32_t srcAddr, size_t nbItems )
+{
+    if ( !_ensureReady()
+        || nbItems == 0
+        || srcAddr >= _maxaddress || nbItems > _maxaddress - srcAddr
+        || dstAddr >= _maxaddress || nbItems > _maxaddress - dstAddr )
+        return false;
+    
+    if (dstAddr == srcAddr)
+        return true;
+    
+    uint8_t buffer[FRAM_COPY_CHUNK];
+    boolean backward = (dstAddr > srcAddr && srcAddr + nbItems > dstAddr);
+    size_t done = 0;
+    
+    while (done < nbItems)
+    {
+        size_t n = nbItems - done;
+        if (n > FRAM_COPY_CHUNK)
+            n = FRAM_COPY_CHUNK;
+        
+        size_t offset = backward ? (nbItems - done - n) : done;
+        
+        if ( !readArray(srcAddr + offset, buffer, n)
+            || !writeArray(dstAddr + offset, buffer, n) )
+            return false;
+        
+        done += n;
+    }
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   stats()
+///              Count, sum, min, max and mean of an array of items,
+///              computed while the bytes come off the bus
+///     @param   startAddr, the memory address of the first item
+///     @param   nbItems, the number of items
+///     @param   type, FRAM_TYPE_UINT8, FRAM_TYPE_INT16, FRAM_TYPE_INT32 or FRAM_TYPE_FLOAT
+///     @param   result, the statistics
+///     @return  0: error
+///              1: ok
+///     @note    One READ transaction, no caller buffer
+**/
+boolean FRAM_MB85RS_SPI::stats( uint32_t startAddr, size_t nbItems, uint8_t type, FRAM_MB85RS_Stats *result )
+{
+    uint8_t size = framItemSize(type);
+    
+    if ( !_ensureReady() || size == 0 || nbItems == 0 || nbItems > _maxaddress / size )
+        return false;
+    
+    FramStatsState st;
+    st.type = type;
+    st.count = 0;
+    st.isum = 0;
+    st.imin = 0x7FFFFFFF;
+    st.imax = -0x7FFFFFFF - 1;
+    st.fsum = 0;
+    st.fmin = INFINITY;
+    st.fmax = -INFINITY;
+    
+    if ( !readStream(startAddr, nbItems * size, framStatsConsumer, &st) )
+        return false;
+    
+    result->count = st.count;
+    if (type == FRAM_TYPE_FLOAT)
+    {
+        result->sum = st.fsum;
+        result->min = st.fmin;
+        result->max = st.fmax;
+    }
+    else
+    {
+        result->sum = (double)st.isum;
+        result->min = st.imin;
+        result->max = st.imax;
+    }
+    result->mean = result->sum / st.count;
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   histogram()
+///              Histogram of an array of items, computed while the bytes
+///              come off the bus
+///     @param   startAddr, the memory address of the first item
+///     @param   nbItems, the number of items
+///     @param   type, FRAM_TYPE_UINT8, FRAM_TYPE_INT16, FRAM_TYPE_INT32 or FRAM_TYPE_FLOAT
+///     @param   low, high, range covered by the bins, items out of
+///              [low, high) are not counted
+///     @param   bins[], nbBins counters of equal width, cleared first
+///     @param   nbBins, the number of bins
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::histogram( uint32_t startAddr, size_t nbItems, uint8_t type, float low, float high,
+                                    uint32_t bins[], uint16_t nbBins )
+{
+    uint8_t size = framItemSize(type);
+    
+    if ( !_ensureReady() || size == 0 || nbItems == 0 || nbItems > _maxaddress / size || nbBins == 0 || !(high > low) )
+        return false;
+    
+    memset(bins, 0, nbBins * sizeof(uint32_t));
+    
+    FramHistogramState st;
+    st.type = type;
+    st.low = low;
+    st.high = high;
+    st.scale = nbBins / (high - low);
+    st.bins = bins;
+    st.nbBins = nbBins;
+    
+    return readStream(startAddr, nbItems * size, framHistogramConsumer, &st);
+}
+
+
+
+/*!
+///     @brief   countIf()
+///              Count the items of an array matching a comparison,
+///              computed while the bytes come off the bus
+///     @param   startAddr, the memory address of the first item
+///     @param   nbItems, the number of items
+///     @param   type, FRAM_TYPE_UINT8, FRAM_TYPE_INT16, FRAM_TYPE_INT32 or FRAM_TYPE_FLOAT
+///     @param   op, FRAM_CMP_LT, _LE, _GT, _GE, _EQ or _NE
+///     @param   threshold, the value items are compared to
+///     @param   result, the number of matching items
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::countIf( uint32_t startAddr, size_t nbItems, uint8_t type, uint8_t op, double threshold,
+                                  uint32_t *result )
+{
+    uint8_t size = framItemSize(type);
+    
+    if ( !_ensureReady() || size == 0 || nbItems == 0 || nbItems > _maxaddress / size || op > FRAM_CMP_NE )
+        return false;
+    
+    FramCountState st;
+    st.type = type;
+    st.op = op;
+    st.threshold = threshold;
+    st.count = 0;
+    
+    // Integer items: turn the comparison into an interval once
+    const double limit = 1099511627776.0; // 2^40, beyond any 32-bits item
+    if (threshold > limit) threshold = limit;
+    if (threshold < -limit) threshold = -limit;
+    
+    st.lo = -(int64_t)limit;
+    st.hi = (int64_t)limit;
+    st.negate = false;
+    
+    switch (op)
+    {
+        case FRAM_CMP_LT: st.hi = (int64_t)ceil(threshold) - 1; break;
+        case FRAM_CMP_LE: st.hi = (int64_t)floor(threshold); break;
+        case FRAM_CMP_GT: st.lo = (int64_t)floor(threshold) + 1; break;
+        case FRAM_CMP_GE: st.lo = (int64_t)ceil(threshold); break;
+        case FRAM_CMP_NE: st.negate = true; // fall through
+        case FRAM_CMP_EQ:
+            st.lo = (int64_t)ceil(threshold);
+            st.hi = (int64_t)floor(threshold);
+            break;
+    }
+    
+    if ( !readStream(startAddr, nbItems * size, framCountConsumer, &st) )
+        return false;
+    
+    *result = st.count;
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   readStream()
+///              Read a range in one READ transaction and pass it to a
+///              consumer FRAM_REDUCE_CHUNK bytes at a time, CS stays
+///              asserted while the consumer runs
+///     @param   startAddr, the memory address to read from
+///     @param   nbItems, the number of bytes to read
+///     @param   consumer, called for each chunk, returns 0 to stop the
+///              stream. It must not access the F-RAM.
+///     @param   context, passed to the consumer
+///     @return  0: error, or stream stopped by the consumer
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::readStream( uint32_t startAddr, size_t nbItems,
+                                     boolean (*consumer)(const uint8_t *data, size_t length, void *context), void *context )
+{
+    if ( !_ensureReady()
+        || startAddr >= _maxaddress
+        || nbItems == 0
+        || nbItems > _maxaddress - startAddr )
+        return false;
+    
+    uint8_t chunk[FRAM_REDUCE_CHUNK];
+    size_t done = 0;
+    
+    // Read byte operation
+    if (!_pushCommand(FRAM_READ, startAddr))
+        return false;
+    
+    while (done < nbItems)
+    {
+        size_t n = nbItems - done;
+        if (n > FRAM_REDUCE_CHUNK)
+            n = FRAM_REDUCE_CHUNK;
+        
+        boolean last = (done + n == nbItems);
+        
+        if ( !_push(NULL, chunk, n, last)
+            || !_submit() )
+            return false;
+        
+        done += n;
+        
+        if (!consumer(chunk, n, context))
+        {
+            // End the READ where it stopped
+            if (!last)
+                _bus->abort();
+            return false;
+        }
+    }
+    
+    _lastaddress = startAddr + nbItems - 1;
+    
+    return true;
+}
+
+
+
+/*!
+///    @brief   isAvailable()
+///             Returns the readiness of the memory chip
+///    @return  0: ready
+///             1: unavailable
+**/
 boolean FRAM_MB85RS_SPI::isAvailable()
 {
-	if ( _framInitialised && digitalReadFast(_cs) == HIGH )
+	if ( _framInitialised && !_bus->isBusy() )
         return true;
     
     return false;
@@ -594,7 +1460,9 @@ boolean FRAM_MB85RS_SPI::enableWP(void)
 {
 	if (_wp)
     {
+#ifdef ARDUINO
 		digitalWriteFast(_wpPin,HIGH);
+#endif
 		_wpStatus = true;
         return true;
 	}
@@ -614,7 +1482,9 @@ boolean FRAM_MB85RS_SPI::disableWP()
 {
 	if (_wp)
     {
+#ifdef ARDUINO
 		digitalWriteFast(_wpPin,LOW);
+#endif
 		_wpStatus = false;
         return true;
 	}
@@ -632,7 +1502,7 @@ boolean FRAM_MB85RS_SPI::disableWP()
 **/
 boolean FRAM_MB85RS_SPI::eraseChip()
 {
-    if ( !_framInitialised )
+    if ( !_ensureReady() )
         return false;
     
     uint32_t i = 0;
@@ -663,11 +1533,13 @@ boolean FRAM_MB85RS_SPI::eraseChip()
 
 /*!
 ///    @brief   getMaxMemAdr()
-///             Return the maximum memory address available
+///             Return the maximum memory address available,
+///             the device is identified first if needed
 ///    @return  _maxaddress
 **/
 uint32_t FRAM_MB85RS_SPI::getMaxMemAdr()
 {
+    _ensureReady();
     return _maxaddress;
 }
 
@@ -696,37 +1568,242 @@ uint32_t FRAM_MB85RS_SPI::getLastMemAdr()
 
 
 /*!
-///     @brief   _csCONFIG()
-///              initialize the chip select line
+///     @brief   _push()
+///              Add a segment to the list sent by _submit(), a full list
+///              is sent first
+///     @param   tx, bytes to send, NULL sends 0x00
+///     @param   rx, bytes received, NULL discards them
+///     @param   length, number of bytes
+///     @param   csRelease, ends the transaction after this segment
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::_push( const uint8_t *tx, uint8_t *rx, size_t length, boolean csRelease )
+{
+    if (_nbSegments == FRAM_MAX_SEGMENTS && !_submit())
+        return false;
+    
+    FRAM_MB85RS_Segment *seg = &_segments[_nbSegments++];
+    seg->tx = tx;
+    seg->rx = rx;
+    seg->length = length;
+    seg->csRelease = csRelease;
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   _pushCommand()
+///              Add an opcode and its memory address, CS stays asserted.
+///              Only chip of 1Mbit or above have their address on 24bit,
+///              all the other chip are addressed on 16-bits only.
+///     @param   opcode, FRAM_READ, FRAM_WRITE...
+///     @param   framAddr, the 32bit address to send
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::_pushCommand( uint8_t opcode, uint32_t framAddr )
+{
+    if (_nbSegments == FRAM_MAX_SEGMENTS && !_submit())
+        return false;
+    
+    uint8_t *command = _commands[_nbSegments];
+    uint8_t length = 0;
+    
+    // The chip expects the address MSB first, so that burst accesses
+    // auto-increment through contiguous addresses
+    command[length++] = opcode;
+    if (_densitycode >= DENSITY_MB85RS1MT)
+        command[length++] = (framAddr >> 16) & 0xFF;  // Bits 16 to 23
+    command[length++] = (framAddr >> 8) & 0xFF;    // Bits 8 to 15
+    command[length++] = framAddr & 0xFF;  // LSB, Bits 0 to 7
+    
+    return _push(command, NULL, length, false);
+}
+
+
+
+/*!
+///     @brief   _submit()
+///              Send the segments added so far to the transport
+///     @return  0: error, the transaction is ended
+///              1: ok
 **/
-void FRAM_MB85RS_SPI::_csCONFIG()
+boolean FRAM_MB85RS_SPI::_submit()
 {
-    pinMode(_cs, OUTPUT);
+    uint8_t nbSegments = _nbSegments;
+    
+    _nbSegments = 0;
+    
+    if (nbSegments == 0)
+        return true;
+    
+    if (_sleeping && !_wake())
+        return false;
+    
+    boolean result = _bus->transfer(_segments, nbSegments);
+    _lastAccess = framMicros();
+    
+    // A failed list may leave CS low in the middle of a stream
+    if (!result)
+        _bus->abort();
+    
+    return result;
 }
 
 
 
 /*!
-///     @brief   _csASSERT()
-///              initialize SPI transactionnal mode and set the chip select
-///              line as active for data transmission/reception
+///     @brief   _access()
+///              Read or write operation on a range, in one call to the
+///              transport. Writes are sent between WREN and WRDI.
+///     @param   opcode, FRAM_READ or FRAM_WRITE
+///     @param   framAddr, the memory address
+///     @param   tx, bytes to write, NULL for a read
+///     @param   rx, bytes read, NULL for a write
+///     @param   length, number of bytes
+///     @return  0: error
+///              1: ok
 **/
-void FRAM_MB85RS_SPI::_csASSERT()
+boolean FRAM_MB85RS_SPI::_access( uint8_t opcode, uint32_t framAddr, const uint8_t *tx, uint8_t *rx, size_t length )
 {
-    SPI.beginTransaction(SPICONFIG);
-    digitalWriteFast(_cs, LOW);
+    boolean writing = (opcode == FRAM_WRITE);
+    
+    // Set Memory Write Enable Latch, otherwise no Write can be achieve
+    if (writing && !_push(&framOpWREN, NULL, 1, true))
+        return false;
+    
+    if ( !_pushCommand(opcode, framAddr)
+        || !_push(tx, rx, length, true) )
+        return false;
+    
+    // Reset Memory Write Enable Latch
+    if (writing && !_push(&framOpWRDI, NULL, 1, true))
+        return false;
+    
+    return _submit();
 }
 
 
 
 /*!
-///     @brief   _csRELEASE(), ends SPI transactionnal mode
-///              and set the chip select line inactive
+///     @brief   _ensureReady()
+///              Complete the initialization on first access, waiting
+///              for what is left of the power-up time
+///     @return  0: device not found
+///              1: device ready
 **/
-void FRAM_MB85RS_SPI::_csRELEASE()
+boolean FRAM_MB85RS_SPI::_ensureReady()
 {
-    digitalWriteFast(_cs, HIGH);
-    SPI.endTransaction();
+    if (_framInitialised)
+        return true;
+    
+    if (_state == FRAM_STATE_IDLE)
+        begin();
+    
+    while (poll() == FRAM_STATE_POWERUP) {}
+    
+    return _framInitialised;
+}
+
+
+
+/*!
+///     @brief   _wake()
+///              Leave sleep mode: a CS pulse, then the recovery time
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::_wake()
+{
+    uint32_t start = framMicros();
+    
+    if (!_wakePulse())
+        return false;
+    
+    while ((uint32_t)(framMicros() - start) < FRAM_RECOVERY_US) {}
+    
+    _wakeTime += framMicros() - start;
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   _wakePulse()
+///              CS pulse leaving sleep mode, without the recovery time
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::_wakePulse()
+{
+    // The byte clocked with the CS pulse is ignored by the chip
+    FRAM_MB85RS_Segment pulse = { NULL, NULL, 1, true };
+    
+    _countSleepTime();
+    
+    if (!_bus->transfer(&pulse, 1))
+    {
+        _bus->abort();
+        return false;
+    }
+    
+    _sleeping = false;
+    _wakeCount++;
+    
+    return true;
+}
+
+
+
+/*!
+///     @brief   _countSleepTime()
+///              Add the time slept since the last count
+**/
+void FRAM_MB85RS_SPI::_countSleepTime()
+{
+    uint32_t now = framMicros();
+    
+    _sleepTimeUs += now - _sleepMark;
+    _sleepMark = now;
+    
+    _sleepTime += _sleepTimeUs / 1000;
+    _sleepTimeUs %= 1000;
+}
+
+
+
+/*!
+///     @brief   _setGeometry()
+///              Set the density and the max address from the density code
+///     @param   densitycode, from 0x03 (64K chip) to 0x08 (2M chip)
+///     @return  0: error, unknown density code
+///              1: ok
+**/
+boolean FRAM_MB85RS_SPI::_setGeometry(uint8_t densitycode)
+{
+    switch (densitycode)
+    {
+        case DENSITY_MB85RS64V:
+        case DENSITY_MB85RS128B:
+        case DENSITY_MB85RS256B:
+        case DENSITY_MB85RS512T:
+        case DENSITY_MB85RS1MT:
+        case DENSITY_MB85RS2MT:
+            _densitycode = densitycode;
+            _density = 1 << (densitycode + 3);          // KBits
+            _maxaddress = (uint32_t)_density * 128;     // Bytes
+            return true;
+
+        default:
+            // F-RAM chip unidentified
+            _density = 0;
+            _maxaddress = 0;
+            return false;
+    }
 }
 
 
@@ -746,52 +1823,26 @@ void FRAM_MB85RS_SPI::_csRELEASE()
 **/
 boolean FRAM_MB85RS_SPI::_getDeviceID()
 {
-	uint8_t buffer[3] = { 0, 0, 0 };
+	uint8_t buffer[4] = { 0, 0, 0, 0 };
     
-    _csASSERT();
-    
-    SPI.transfer(FRAM_RDID);
-    _manufacturer = SPI.transfer(0);
-    buffer[0] = SPI.transfer(0);
-    buffer[1] = SPI.transfer(0);
-    buffer[2] = SPI.transfer(0);
+    if ( !_push(&framOpRDID, NULL, 1, false)
+        || !_push(NULL, buffer, 4, true)
+        || !_submit() )
+        return false;
     
-    _csRELEASE();
+    _manufacturer = buffer[0];
 
 	/* Shift values to separate IDs */
-	_densitycode = buffer[1] &= (1<<5)-1; // Only the 5 first bits
+	_densitycode = buffer[2] & ((1<<5)-1); // Only the 5 first bits
 	_productID = (buffer[2] << 8) + buffer[3]; // Is really necessary to read this info ?
 
 	if (_manufacturer == FUJITSU_ID)
-    {
-        switch (_densitycode)
-        {
-            case DENSITY_MB85RS64V:
-            case DENSITY_MB85RS128B:
-            case DENSITY_MB85RS256B:
-            case DENSITY_MB85RS512T:
-            case DENSITY_MB85RS1MT:
-            case DENSITY_MB85RS2MT:
-                _density = pow (2, _densitycode+3);
-                _maxaddress = _density*128;
-                break;
-
-            default:
-                // F-RAM chip unidentified
-                _density = 0;
-                _maxaddress = 0;
-                return false;
-                break;
-        }
-    } else {
-        // F-RAM chip unidentified
-        _density = 0;
-        _maxaddress = 0;
-        return false;
-	}
+        return _setGeometry(_densitycode);
     
-
-  return true;
+    // F-RAM chip unidentified
+    _density = 0;
+    _maxaddress = 0;
+    return false;
 }
 
 
@@ -805,10 +1856,10 @@ boolean FRAM_MB85RS_SPI::_getDeviceID()
 **/
 boolean FRAM_MB85RS_SPI::_deviceID2Serial()
 {
-    if (!Serial)
-        return false; // Serial not available
-    
 	#ifdef CHIP_TRACE
+        if (!Serial)
+            return false; // Serial not available
+    
         Serial.println("\n** F-RAM Device IDs");
         Serial.print("Manufacturer 0x"); Serial.println(_manufacturer, HEX);
         Serial.print("ProductID 0x"); Serial.println(_productID, HEX);
@@ -827,19 +1878,48 @@ boolean FRAM_MB85RS_SPI::_deviceID2Serial()
 
 
 /*!
-///     @brief   _setMemAddr()
-///              Set the memory address coded on 24-bits over SPI
-///              Only chip of 1Mbit or above have their address on 24bit,
-///              all the other chip are addressed on 16-bits only.
-///     @param   framAddr, the 32bit address to send
+///     @brief   _writeStream()
+///              Write a range in one WRITE transaction, the bytes are asked
+///              to a producer FRAM_REDUCE_CHUNK bytes at a time, CS stays
+///              asserted while the producer runs
+///     @param   startAddr, the memory address to write from
+///     @param   nbItems, the number of bytes to write
+///     @param   producer, fills each chunk
+///     @param   context, passed to the producer
+///     @return  0: error
+///              1: ok
 **/
-void FRAM_MB85RS_SPI::_setMemAddr( uint32_t *framAddr )
+boolean FRAM_MB85RS_SPI::_writeStream( uint32_t startAddr, size_t nbItems,
+                                       void (*producer)(uint8_t *data, size_t length, void *context), void *context )
 {
-    SPI.transfer(*framAddr & 0xFF);  // MSB, Bits 0 to 7
-    SPI.transfer((*framAddr >> 8) & 0xFF);    // Bits 8 to 15
-    if (_densitycode >= DENSITY_MB85RS1MT)
-        SPI.transfer((*framAddr >> 16) & 0xFF);  // Bits 16 to 23
+    uint8_t chunk[FRAM_REDUCE_CHUNK];
+    size_t done = 0;
+    
+    // Set Memory Write Enable Latch, then write byte operation
+    if ( !_push(&framOpWREN, NULL, 1, true)
+        || !_pushCommand(FRAM_WRITE, startAddr) )
+        return false;
     
-    _lastaddress = *framAddr;
+    while (done < nbItems)
+    {
+        size_t n = nbItems - done;
+        if (n > FRAM_REDUCE_CHUNK)
+            n = FRAM_REDUCE_CHUNK;
+        
+        boolean last = (done + n == nbItems);
+        
+        producer(chunk, n, context);
+        
+        // Reset Memory Write Enable Latch with the last chunk
+        if ( !_push(chunk, NULL, n, last)
+            || (last && !_push(&framOpWRDI, NULL, 1, true))
+            || !_submit() )
+            return false;
+        
+        done += n;
+    }
+    
+    return true;
 }
 
+
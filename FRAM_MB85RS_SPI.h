@@ -43,17 +43,43 @@
 #ifndef __FRAM_MB85RS_SPI_H__
 #define __FRAM_MB85RS_SPI_H__
 
-#include <SPI.h>
+#include <FRAM_MB85RS_Transport.h>
 
 
 // DEFINES
 
-#define SPICONFIG   SPISettings(28000000, MSBFIRST, SPI_MODE0) // SPI frequency (24 MHz max), MODE 0
-#ifndef DEBUG_TRACE
-    #define DEBUG_TRACE    // Enabling Debug Trace on Serial
+// Serial traces are off by default, the library never touches Serial otherwise.
+// Uncomment to enable them, Serial has to be started by the sketch.
+//#define DEBUG_TRACE    // Enabling Debug Trace on Serial
+//#define CHIP_TRACE     // Serial trace for characteristics of the chip
+
+// Serial traces need an Arduino core
+#ifndef ARDUINO
+    #undef DEBUG_TRACE
+    #undef CHIP_TRACE
+#endif
+
+// Segments handed to the transport in one call. A write takes 4 of them
+// (WREN, WRITE + address, data, WRDI). Longer lists are sent in several
+// calls, CS held where a transaction goes on: a gather takes 2 or 3
+// segments per READ transaction (command, skipped gap, data), so only
+// short gathers reach the transport in one call.
+#ifndef FRAM_MAX_SEGMENTS
+    #define FRAM_MAX_SEGMENTS 8
+#endif
+
+// Power-up time, from VDD up to the first access (tPU in datasheets).
+// Counted from the MCU reset, framMicros() = 0, which is conservative: the
+// supply is up before the MCU starts counting. A begin() called later
+// than that does not wait.
+#ifndef FRAM_POWERUP_US
+    #define FRAM_POWERUP_US 250
 #endif
-#ifndef CHIP_TRACE
-    #define CHIP_TRACE     // Serial trace for characteristics of the chip
+
+// Recovery time from sleep mode, from the CS falling edge up to the first
+// access (tREC in datasheets, raise it if the chip's datasheet gives more)
+#ifndef FRAM_RECOVERY_US
+    #define FRAM_RECOVERY_US 400
 #endif
 
 
@@ -80,6 +106,68 @@
 #define FRAM_SLEEP 0xB9 // 1011 1001 - Sleep mode
 
 
+// Initialization states, see begin() and poll()
+#define FRAM_STATE_IDLE     0 // begin() not called yet
+#define FRAM_STATE_POWERUP  1 // Waiting for the power-up time
+#define FRAM_STATE_READY    2 // Device identified, ready for use
+#define FRAM_STATE_ERROR    3 // Device not found
+
+
+// Gather reads: cost of a new READ transaction besides its opcode and address,
+// in byte times (CS setup/hold, transaction begin/end). Ranges closer than
+// opcode + address + FRAM_CS_OVERHEAD bytes are read in the same transaction.
+#ifndef FRAM_CS_OVERHEAD
+    #define FRAM_CS_OVERHEAD 2
+#endif
+
+// copy() and move() go through a stack buffer of FRAM_COPY_CHUNK bytes,
+// each chunk costs one READ and one WRITE
+#ifndef FRAM_COPY_CHUNK
+    #define FRAM_COPY_CHUNK 128
+#endif
+
+// Item types for the reductions
+#define FRAM_TYPE_UINT8  0
+#define FRAM_TYPE_INT16  1
+#define FRAM_TYPE_INT32  2
+#define FRAM_TYPE_FLOAT  3
+
+// Comparisons for countIf()
+#define FRAM_CMP_LT 0 // item <  threshold
+#define FRAM_CMP_LE 1 // item <= threshold
+#define FRAM_CMP_GT 2 // item >  threshold
+#define FRAM_CMP_GE 3 // item >= threshold
+#define FRAM_CMP_EQ 4 // item == threshold
+#define FRAM_CMP_NE 5 // item != threshold
+
+// Reductions, fills and 16-bits writes stream the range in one transaction,
+// FRAM_REDUCE_CHUNK bytes at a time through a stack buffer (multiple of 4)
+#ifndef FRAM_REDUCE_CHUNK
+    #define FRAM_REDUCE_CHUNK 64
+#endif
+
+// Items of the reductions never straddle two chunks
+#if FRAM_REDUCE_CHUNK <= 0 || FRAM_REDUCE_CHUNK % 4 != 0
+    #error "FRAM_REDUCE_CHUNK must be a non-zero multiple of 4"
+#endif
+
+struct FRAM_MB85RS_Stats
+{
+    uint32_t    count;      // Number of items
+    double      sum;
+    double      min;
+    double      max;
+    double      mean;
+};
+
+struct FRAM_MB85RS_Gather
+{
+    uint32_t    addr;       // F-RAM address to read from
+    size_t      length;     // Number of bytes to read
+    void       *dest;       // Where the bytes go
+};
+
+
 // Managing Write protect pin
 // false means protection off, write enabled
 #define DEFAULT_WP_STATUS false
@@ -88,11 +176,26 @@
 class FRAM_MB85RS_SPI
 {
  public:
+#ifdef ARDUINO
     FRAM_MB85RS_SPI(uint8_t cs);
     FRAM_MB85RS_SPI(uint8_t cs, uint8_t wp);
+#endif
+    FRAM_MB85RS_SPI(FRAM_MB85RS_Transport &transport);
     
 
     void	init();
+    void	begin();
+    void	begin(uint8_t densitycode);
+    uint8_t	poll();
+    boolean	isReady();
+    uint32_t	getInitTime();
+    
+    void	setSleepTimeout(uint32_t idleTime);
+    boolean	sleep();
+    boolean	isSleeping();
+    uint32_t	getSleepTime();
+    uint32_t	getWakeCount();
+    uint32_t	getWakeTime();
     boolean	checkDevice();
     
     boolean	read(uint32_t framAddr, uint8_t *value);
@@ -106,6 +209,18 @@ class FRAM_MB85RS_SPI
     boolean readArray(uint32_t startAddr, uint16_t values[], size_t nbItems );
     boolean writeArray(uint32_t startAddr, uint8_t values[], size_t nbItems );
     boolean writeArray(uint32_t startAddr, uint16_t values[], size_t nbItems );
+    boolean fillArray(uint32_t startAddr, uint8_t value, size_t nbItems );
+    uint16_t gather(FRAM_MB85RS_Gather requests[], uint16_t nbRequests);
+    boolean copy(uint32_t dstAddr, uint32_t srcAddr, size_t nbItems);
+    boolean move(uint32_t dstAddr, uint32_t srcAddr, size_t nbItems);
+    
+    boolean stats(uint32_t startAddr, size_t nbItems, uint8_t type, FRAM_MB85RS_Stats *result);
+    boolean histogram(uint32_t startAddr, size_t nbItems, uint8_t type, float low, float high,
+                      uint32_t bins[], uint16_t nbBins);
+    boolean countIf(uint32_t startAddr, size_t nbItems, uint8_t type, uint8_t op, double threshold,
+                    uint32_t *result);
+    boolean readStream(uint32_t startAddr, size_t nbItems,
+                       boolean (*consumer)(const uint8_t *data, size_t length, void *context), void *context);
     
     boolean	isAvailable();
     boolean	getWPStatus();
@@ -119,7 +234,13 @@ class FRAM_MB85RS_SPI
  private:
     
     boolean		_framInitialised;
-    uint8_t     _cs;            // CS pin
+#ifdef ARDUINO
+    FRAM_MB85RS_ArduinoSPI _spi; // Default transport, hardware SPI
+#endif
+    FRAM_MB85RS_Transport *_bus; // Transport in use
+    FRAM_MB85RS_Segment _segments[FRAM_MAX_SEGMENTS]; // Segments not sent yet
+    uint8_t     _commands[FRAM_MAX_SEGMENTS][4]; // Opcode and address of the command segments
+    uint8_t     _nbSegments;    // Segments used
     boolean     _wp;            // WP management
     uint8_t     _wpPin;         // WP pin connected and Write Protection enabled
     boolean     _wpStatus;      // WP Status
@@ -129,13 +250,33 @@ class FRAM_MB85RS_SPI
     uint16_t	_density;       // Human readable size of F-RAM chip
     uint32_t	_maxaddress;    // Maximum address suported by F-RAM chip
     uint32_t    _lastaddress;   // Last address used in memory
+    uint8_t     _state;         // Initialization state, FRAM_STATE_xxx
+    boolean     _trustDensity;  // Geometry given to begin(), RDID skipped
+    uint32_t    _beginTime;     // framMicros() when begin() was called
+    uint32_t    _powerupWait;   // Part of tPU left at begin(), in us
+    uint32_t    _initTime;      // Time from begin() to ready, in us
+    uint32_t    _lastAccess;    // framMicros() at the end of the last transfer
+    uint32_t    _sleepTimeout;  // Idle time before sleep, in us, 0: never
+    boolean     _sleeping;      // Sleep mode entered
+    uint32_t    _sleepMark;     // framMicros() up to which _sleepTime is counted
+    uint32_t    _sleepTime;     // Time spent in sleep mode, in ms
+    uint32_t    _sleepTimeUs;   // and the remaining us
+    uint32_t    _wakeCount;     // Wake-ups
+    uint32_t    _wakeTime;      // Time spent waking up, in us
     
-    void        _csCONFIG();
-    void        _csASSERT();
-    void        _csRELEASE();
+    boolean     _ensureReady();
+    boolean     _setGeometry(uint8_t densitycode);
+    boolean     _wake();
+    boolean     _wakePulse();
+    void        _countSleepTime();
     boolean     _getDeviceID();
     boolean     _deviceID2Serial();
-    void        _setMemAddr(uint32_t *framAddr);
+    boolean     _push(const uint8_t *tx, uint8_t *rx, size_t length, boolean csRelease);
+    boolean     _pushCommand(uint8_t opcode, uint32_t framAddr);
+    boolean     _submit();
+    boolean     _access(uint8_t opcode, uint32_t framAddr, const uint8_t *tx, uint8_t *rx, size_t length);
+    boolean     _writeStream(uint32_t startAddr, size_t nbItems,
+                             void (*producer)(uint8_t *data, size_t length, void *context), void *context);
 };
 
 
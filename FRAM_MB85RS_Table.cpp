@@ -0,0 +1,465 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Table.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Columnar record table for the MB85RS SPI FRAM series.
+
+    F-RAM layout from startAddr:
+        [0..3]  number of rows written
+        then one segment of capacity * size bytes per column, in the
+        order of the column descriptions
+
+    Appended records are split by column in a RAM buffer. Once the buffer
+    is full, or on flush(), every column is written in one burst.
+
+    Usage:
+        struct Record { uint32_t time; int16_t temp; uint8_t flags; };
+        const FRAM_MB85RS_Column cols[] = {
+            TABLE_COLUMN(Record, time),
+            TABLE_COLUMN(Record, temp),
+            TABLE_COLUMN(Record, flags) };
+        FRAM_MB85RS_Table table(FRAM, 0, 1000, cols, 3);
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_Table.h>
+
+
+// scan() state, the stream cuts values across chunks
+struct FramScanState
+{
+    boolean   (*callback)(uint32_t row, const void *value, void *context);
+    void       *context;
+    uint32_t    row;            // Row of the next value
+    uint16_t    size;           // Column size
+    uint16_t    filled;         // Bytes of value[] received
+    uint8_t     value[FRAM_REDUCE_CHUNK];
+};
+
+static boolean framScanConsumer(const uint8_t *data, size_t length, void *context)
+{
+    FramScanState *st = (FramScanState *)context;
+
+    while (length > 0)
+    {
+        if (st->filled == 0 && length >= st->size)
+        {
+            // Whole value in the chunk
+            if (!st->callback(st->row++, data, st->context))
+                return false;
+            data += st->size;
+            length -= st->size;
+            continue;
+        }
+
+        size_t n = st->size - st->filled;
+        if (n > length)
+            n = length;
+
+        memcpy(&st->value[st->filled], data, n);
+        st->filled += n;
+        data += n;
+        length -= n;
+
+        if (st->filled == st->size)
+        {
+            st->filled = 0;
+            if (!st->callback(st->row++, st->value, st->context))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*========================================================================*/
+/*                            CONSTRUCTORS                                */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_Table()
+///              Constructor, nothing is read or written before begin() or format()
+///     @param   fram, the F-RAM device
+///     @param   startAddr, F-RAM address of the table
+///     @param   capacity, maximum number of rows
+///     @param   columns[], description of the columns, must stay in scope
+///     @param   nbColumns, number of columns, up to TABLE_MAX_COLUMNS
+**/
+FRAM_MB85RS_Table::FRAM_MB85RS_Table(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t capacity,
+                                     const FRAM_MB85RS_Column columns[], uint8_t nbColumns)
+    : _fram(fram)
+{
+    _startAddr = startAddr;
+    _capacity = capacity;
+    _columns = columns;
+    _nbColumns = nbColumns;
+    _width = 0;
+    _bufferRows = 0;
+    _pending = 0;
+    _written = 0;
+    _valid = false;
+    _open = false;
+
+    if (nbColumns == 0 || nbColumns > TABLE_MAX_COLUMNS)
+        return;
+
+    for (uint8_t c = 0; c < nbColumns; c++)
+        _width += columns[c].size;
+
+    if (_width == 0)
+        return;
+
+    _bufferRows = TABLE_BUFFER_SIZE / _width;
+
+    uint32_t columnOffset = 0;
+    for (uint8_t c = 0; c < nbColumns; c++)
+    {
+        _columnAddr[c] = startAddr + TABLE_HEADER_SIZE + capacity * columnOffset;
+        _bufferOffset[c] = _bufferRows * columnOffset;
+        columnOffset += columns[c].size;
+    }
+
+    _valid = (_bufferRows > 0);
+}
+
+
+
+/*========================================================================*/
+/*                           PUBLIC FUNCTIONS                             */
+/*========================================================================*/
+
+
+/*!
+///     @brief   format()
+///              Empty the table
+///     @return  0: error, the table does not fit in the chip
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::format()
+{
+    _open = false;
+
+    if (!_fits())
+        return false;
+
+    _pending = 0;
+    _written = 0;
+
+    if (!_writeCount(0))
+        return false;
+
+    _open = true;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Open an existing table
+///     @return  0: error, the table does not fit in the chip or is not formatted
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::begin()
+{
+    _open = false;
+
+    if (!_fits())
+        return false;
+
+    uint8_t header[TABLE_HEADER_SIZE];
+    if (!_fram.readArray(_startAddr, header, TABLE_HEADER_SIZE))
+        return false;
+
+    uint32_t count = (uint32_t)header[0] | ((uint32_t)header[1] << 8)
+                   | ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+
+    if (count > _capacity)
+        return false;
+
+    _pending = 0;
+    _written = count;
+    _open = true;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   append()
+///              Append a record, split by column in the RAM buffer.
+///              The buffer is written as soon as it is full. If that
+///              fails, the rows stay buffered and the next append() or
+///              flush() writes them again.
+///     @param   record, the record structure described by the columns
+///     @return  0: error, table full, not opened by format() or begin(),
+///              or the buffered rows cannot be written. The record is not
+///              appended.
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::append(const void *record)
+{
+    if (!_open || getRowCount() >= _capacity)
+        return false;
+
+    // Room for the record, rows left by a failed write go first
+    if (_pending == _bufferRows && !flush())
+        return false;
+
+    const uint8_t *src = (const uint8_t *)record;
+
+    for (uint8_t c = 0; c < _nbColumns; c++)
+        memcpy(&_buffer[_bufferOffset[c] + _pending * _columns[c].size],
+               &src[_columns[c].offset], _columns[c].size);
+
+    _pending++;
+
+    if (_pending == _bufferRows)
+        flush();
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   flush()
+///              Write the buffered rows, one burst per column,
+///              then the row count. The rows leave the buffer only
+///              once the count is written: after an error the next
+///              flush() writes them again, with the count
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::flush()
+{
+    if (_pending == 0)
+        return true;
+
+    for (uint8_t c = 0; c < _nbColumns; c++)
+        if (!_fram.writeArray(_columnAddr[c] + _written * _columns[c].size,
+                              &_buffer[_bufferOffset[c]], _pending * _columns[c].size))
+            return false;
+
+    if (!_writeCount(_written + _pending))
+        return false;
+
+    _written += _pending;
+    _pending = 0;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   readRecord()
+///              Rebuild a complete record from all the columns
+///     @param   row, index of the row
+///     @param   record, the record structure to fill
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::readRecord(uint32_t row, void *record)
+{
+    if (!_valid || row >= getRowCount())
+        return false;
+
+    uint8_t *dst = (uint8_t *)record;
+
+    for (uint8_t c = 0; c < _nbColumns; c++)
+    {
+        uint16_t size = _columns[c].size;
+
+        if (row >= _written)
+            memcpy(&dst[_columns[c].offset], &_buffer[_bufferOffset[c] + (row - _written) * size], size);
+        else if (!_fram.readArray(_columnAddr[c] + row * size, &dst[_columns[c].offset], size))
+            return false;
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   readColumn()
+///              Read consecutive values of one column in one burst
+///     @param   column, index of the column
+///     @param   firstRow, first row to read
+///     @param   nbRows, number of rows to read
+///     @param   values, array of nbRows values of the column size
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::readColumn(uint8_t column, uint32_t firstRow, uint32_t nbRows, void *values)
+{
+    uint32_t rowCount = getRowCount();
+
+    if (!_valid || column >= _nbColumns || nbRows == 0
+        || firstRow >= rowCount || nbRows > rowCount - firstRow)
+        return false;
+
+    uint16_t size = _columns[column].size;
+    uint8_t *dst = (uint8_t *)values;
+
+    if (firstRow < _written)
+    {
+        uint32_t n = (nbRows < _written - firstRow) ? nbRows : _written - firstRow;
+
+        if (!_fram.readArray(_columnAddr[column] + firstRow * size, dst, n * size))
+            return false;
+
+        dst += n * size;
+        firstRow += n;
+        nbRows -= n;
+    }
+
+    if (nbRows > 0)
+        memcpy(dst, &_buffer[_bufferOffset[column] + (firstRow - _written) * size], nbRows * size);
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   scan()
+///              Stream the values of one column to a callback, in one
+///              READ through readStream(), without caller buffer
+///     @param   column, index of the column, up to FRAM_REDUCE_CHUNK bytes wide
+///     @param   firstRow, first row to scan
+///     @param   nbRows, number of rows to scan
+///     @param   callback, called for each value, returns 0 to stop the scan.
+///              The value is not aligned, copy it before use. CS is held
+///              while it runs, it must not access the F-RAM.
+///     @param   context, passed to the callback
+///     @return  0: error, or scan stopped by the callback
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::scan(uint8_t column, uint32_t firstRow, uint32_t nbRows,
+                                boolean (*callback)(uint32_t row, const void *value, void *context), void *context)
+{
+    uint32_t rowCount = getRowCount();
+
+    if (!_valid || column >= _nbColumns || callback == NULL
+        || firstRow >= rowCount || nbRows > rowCount - firstRow)
+        return false;
+
+    uint16_t size = _columns[column].size;
+
+    if (size > FRAM_REDUCE_CHUNK)
+        return false;
+
+    uint32_t row = firstRow;
+    uint32_t last = firstRow + nbRows;
+
+    if (row < last && row < _written)
+    {
+        uint32_t n = (last < _written) ? last - row : _written - row;
+
+        FramScanState st;
+        st.callback = callback;
+        st.context = context;
+        st.row = row;
+        st.size = size;
+        st.filled = 0;
+
+        if (!_fram.readStream(_columnAddr[column] + row * size, n * size, framScanConsumer, &st))
+            return false;
+
+        row += n;
+    }
+
+    for (; row < last; row++)
+        if (!callback(row, &_buffer[_bufferOffset[column] + (row - _written) * size], context))
+            return false;
+
+    return true;
+}
+
+
+
+/*!
+///    @brief   getRowCount()
+///    @return  number of rows, buffered ones included
+**/
+uint32_t FRAM_MB85RS_Table::getRowCount()
+{
+    return _written + _pending;
+}
+
+
+
+/*!
+///    @brief   getCapacity()
+///    @return  _capacity
+**/
+uint32_t FRAM_MB85RS_Table::getCapacity()
+{
+    return _capacity;
+}
+
+
+
+/*!
+///    @brief   getSize()
+///    @return  number of F-RAM bytes used by the table
+**/
+uint32_t FRAM_MB85RS_Table::getSize()
+{
+    return TABLE_HEADER_SIZE + _capacity * _width;
+}
+
+
+
+/*========================================================================*/
+/*                           PRIVATE FUNCTIONS                            */
+/*========================================================================*/
+
+
+/*!
+///     @brief   _fits()
+///              Check the layout against the chip, without overflow
+///     @return  0: the columns or the table do not fit
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::_fits()
+{
+    uint32_t maxAddr = _fram.getMaxMemAdr();
+
+    if (!_valid || _startAddr >= maxAddr || maxAddr - _startAddr < TABLE_HEADER_SIZE)
+        return false;
+
+    return _capacity <= (maxAddr - _startAddr - TABLE_HEADER_SIZE) / _width;
+}
+
+
+/*!
+///     @brief   _writeCount()
+///              Write the number of rows on F-RAM
+///     @param   count, rows on F-RAM
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Table::_writeCount(uint32_t count)
+{
+    uint8_t header[TABLE_HEADER_SIZE];
+
+    header[0] = count & 0xFF;
+    header[1] = (count >> 8) & 0xFF;
+    header[2] = (count >> 16) & 0xFF;
+    header[3] = (count >> 24) & 0xFF;
+
+    return _fram.writeArray(_startAddr, header, TABLE_HEADER_SIZE);
+}
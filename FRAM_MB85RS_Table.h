@@ -0,0 +1,96 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Table.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Columnar record table for the MB85RS SPI FRAM series.
+    Each field of a record is stored in its own contiguous column, so
+    scanning one field reads only that field from the chip.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_TABLE_H__
+#define __FRAM_MB85RS_TABLE_H__
+
+#include <stddef.h>
+#include <FRAM_MB85RS_SPI.h>
+
+
+// DEFINES
+
+// Maximum number of columns of a table
+#ifndef TABLE_MAX_COLUMNS
+    #define TABLE_MAX_COLUMNS 16
+#endif
+
+// RAM buffer shared by all the columns for the rows not yet written,
+// it holds TABLE_BUFFER_SIZE / record width rows
+#ifndef TABLE_BUFFER_SIZE
+    #define TABLE_BUFFER_SIZE 256
+#endif
+
+// Header in front of the columns: number of rows written (32-bits)
+#define TABLE_HEADER_SIZE 4
+
+// Column description from a field of the record structure
+#define TABLE_COLUMN(type, field) { offsetof(type, field), sizeof(((type *)0)->field) }
+
+
+struct FRAM_MB85RS_Column
+{
+    uint16_t    offset;     // Offset of the field in the record
+    uint16_t    size;       // Size of the field in bytes
+};
+
+
+class FRAM_MB85RS_Table
+{
+ public:
+    FRAM_MB85RS_Table(FRAM_MB85RS_SPI &fram, uint32_t startAddr, uint32_t capacity,
+                      const FRAM_MB85RS_Column columns[], uint8_t nbColumns);
+
+    boolean format();
+    boolean begin();
+
+    boolean append(const void *record);
+    boolean flush();
+
+    boolean readRecord(uint32_t row, void *record);
+    boolean readColumn(uint8_t column, uint32_t firstRow, uint32_t nbRows, void *values);
+    boolean scan(uint8_t column, uint32_t firstRow, uint32_t nbRows,
+                 boolean (*callback)(uint32_t row, const void *value, void *context), void *context);
+
+    uint32_t getRowCount();
+    uint32_t getCapacity();
+    uint32_t getSize();
+
+
+ private:
+
+    FRAM_MB85RS_SPI    &_fram;
+    uint32_t    _startAddr;     // F-RAM address of the header
+    uint32_t    _capacity;      // Maximum number of rows
+    const FRAM_MB85RS_Column   *_columns;
+    uint8_t     _nbColumns;
+    uint16_t    _width;         // Sum of the column sizes
+    uint32_t    _columnAddr[TABLE_MAX_COLUMNS];     // F-RAM address of each column
+    uint16_t    _bufferOffset[TABLE_MAX_COLUMNS];   // Offset of each column in _buffer
+
+    uint8_t     _buffer[TABLE_BUFFER_SIZE];
+    uint16_t    _bufferRows;    // Capacity of _buffer in rows
+    uint16_t    _pending;       // Rows in _buffer
+    uint32_t    _written;       // Rows on F-RAM
+    boolean     _valid;         // Columns fit in the buffer
+    boolean     _open;          // format() or begin() succeeded
+
+    boolean     _fits();
+    boolean     _writeCount(uint32_t count);
+};
+
+
+
+#endif
@@ -0,0 +1,761 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Transport.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Bus access for the MB85RS SPI FRAM series.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <FRAM_MB85RS_SPI.h>
+
+#if defined(__linux__) && !defined(ARDUINO)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <linux/spi/spidev.h>
+#endif
+
+
+
+/*========================================================================*/
+/*                              TRANSPORT                                 */
+/*========================================================================*/
+
+
+/*!
+///     @brief   isBusy()
+///     @return  0: CS released
+///              1: a transaction is open
+**/
+boolean FRAM_MB85RS_Transport::isBusy()
+{
+    return false;
+}
+
+
+
+/*!
+///     @brief   abort()
+///              Release CS at once, ending the open transaction without
+///              clocking anything. Called by the driver when transfer()
+///              fails. Transports which keep CS low across calls must
+///              override it.
+**/
+void FRAM_MB85RS_Transport::abort()
+{
+}
+
+
+
+#ifdef ARDUINO
+
+/*========================================================================*/
+/*                             ARDUINO SPI                                */
+/*========================================================================*/
+
+// Bytes sent through a stack buffer by block transfers, for the segments
+// with nothing to receive
+#ifndef FRAM_SPI_CHUNK
+    #define FRAM_SPI_CHUNK 32
+#endif
+
+
+/*!
+///     @brief   FRAM_MB85RS_ArduinoSPI()
+///              Constructor, the CS line is configured and released
+///     @param   cs, chip select pin - active low, FRAM_NO_PIN if none
+**/
+FRAM_MB85RS_ArduinoSPI::FRAM_MB85RS_ArduinoSPI(uint8_t cs)
+{
+    _cs = cs;
+    _asserted = false;
+
+    if (_cs != FRAM_NO_PIN)
+    {
+        pinMode(_cs, OUTPUT);
+        digitalWriteFast(_cs, HIGH);
+    }
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Start the SPI bus
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_ArduinoSPI::begin()
+{
+    if (_cs == FRAM_NO_PIN)
+        return false;
+
+    SPI.begin();
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   transfer()
+///              Clock a segment list, segments are sent with block transfers
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_ArduinoSPI::transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments)
+{
+    for (uint8_t i = 0; i < nbSegments; i++)
+    {
+        FRAM_MB85RS_Segment *seg = &segments[i];
+
+        if (!_asserted)
+        {
+            SPI.beginTransaction(SPICONFIG);
+            digitalWriteFast(_cs, LOW);
+            _asserted = true;
+        }
+
+        if (seg->rx != NULL)
+        {
+            // Received bytes replace the sent ones in the buffer
+            if (seg->tx == NULL)
+                memset(seg->rx, 0, seg->length);
+            else if (seg->tx != seg->rx)
+                memmove(seg->rx, seg->tx, seg->length);
+
+            SPI.transfer(seg->rx, seg->length);
+        }
+        else
+        {
+            uint8_t chunk[FRAM_SPI_CHUNK];
+
+            for (size_t done = 0; done < seg->length; )
+            {
+                size_t n = seg->length - done;
+                if (n > FRAM_SPI_CHUNK)
+                    n = FRAM_SPI_CHUNK;
+
+                if (seg->tx == NULL)
+                    memset(chunk, 0, n);
+                else
+                    memcpy(chunk, &seg->tx[done], n);
+
+                SPI.transfer(chunk, n);
+                done += n;
+            }
+        }
+
+        if (seg->csRelease)
+        {
+            digitalWriteFast(_cs, HIGH);
+            SPI.endTransaction();
+            _asserted = false;
+        }
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   isBusy()
+///     @return  0: CS released
+///              1: CS line low
+**/
+boolean FRAM_MB85RS_ArduinoSPI::isBusy()
+{
+    return _asserted || digitalReadFast(_cs) == LOW;
+}
+
+
+
+/*!
+///     @brief   abort()
+///              Release CS, ending the open transaction
+**/
+void FRAM_MB85RS_ArduinoSPI::abort()
+{
+    if (!_asserted)
+        return;
+
+    digitalWriteFast(_cs, HIGH);
+    SPI.endTransaction();
+    _asserted = false;
+}
+
+
+
+/*========================================================================*/
+/*                              BIT-BANG                                  */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_BitBang()
+///              Constructor, SPI mode 0 on GPIO pins
+///     @param   cs, chip select pin - active low
+///     @param   sck, clock pin
+///     @param   mosi, pin connected to SI of the chip
+///     @param   miso, pin connected to SO of the chip
+**/
+FRAM_MB85RS_BitBang::FRAM_MB85RS_BitBang(uint8_t cs, uint8_t sck, uint8_t mosi, uint8_t miso)
+{
+    _cs = cs;
+    _sck = sck;
+    _mosi = mosi;
+    _miso = miso;
+    _asserted = false;
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Configure the pins, clock idle low, CS released
+///     @return  1: ok
+**/
+boolean FRAM_MB85RS_BitBang::begin()
+{
+    pinMode(_cs, OUTPUT);
+    pinMode(_sck, OUTPUT);
+    pinMode(_mosi, OUTPUT);
+    pinMode(_miso, INPUT);
+
+    digitalWriteFast(_cs, HIGH);
+    digitalWriteFast(_sck, LOW);
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   transfer()
+///              Clock a segment list bit by bit
+///     @return  1: ok
+**/
+boolean FRAM_MB85RS_BitBang::transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments)
+{
+    for (uint8_t i = 0; i < nbSegments; i++)
+    {
+        FRAM_MB85RS_Segment *seg = &segments[i];
+
+        if (!_asserted)
+        {
+            digitalWriteFast(_cs, LOW);
+            _asserted = true;
+        }
+
+        for (size_t k = 0; k < seg->length; k++)
+        {
+            uint8_t value = _transferByte(seg->tx != NULL ? seg->tx[k] : 0);
+            if (seg->rx != NULL)
+                seg->rx[k] = value;
+        }
+
+        if (seg->csRelease)
+        {
+            digitalWriteFast(_cs, HIGH);
+            _asserted = false;
+        }
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   isBusy()
+///     @return  0: CS released
+///              1: a transaction is open
+**/
+boolean FRAM_MB85RS_BitBang::isBusy()
+{
+    return _asserted;
+}
+
+
+
+/*!
+///     @brief   abort()
+///              Release CS, ending the open transaction
+**/
+void FRAM_MB85RS_BitBang::abort()
+{
+    digitalWriteFast(_cs, HIGH);
+    _asserted = false;
+}
+
+
+
+/*!
+///     @brief   _transferByte()
+///              Mode 0, MSB first: data set on the falling edge,
+///              sampled on the rising edge
+///     @return  the byte received
+**/
+uint8_t FRAM_MB85RS_BitBang::_transferByte(uint8_t value)
+{
+    uint8_t received = 0;
+
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+        digitalWriteFast(_mosi, (value & 0x80) ? HIGH : LOW);
+        value <<= 1;
+
+        digitalWriteFast(_sck, HIGH);
+        received = (received << 1) | (digitalReadFast(_miso) ? 1 : 0);
+        digitalWriteFast(_sck, LOW);
+    }
+
+    return received;
+}
+
+#endif
+
+
+
+/*========================================================================*/
+/*                              SIMULATOR                                 */
+/*========================================================================*/
+
+
+/*!
+///     @brief   FRAM_MB85RS_Simulator()
+///              Constructor
+///     @param   memory[], content of the chip, from 8KB (MB85RS64V)
+///              to 256KB (MB85RS2MT) depending on the density code
+///     @param   densitycode, DENSITY_MB85RSxxx code of the simulated chip
+**/
+FRAM_MB85RS_Simulator::FRAM_MB85RS_Simulator(uint8_t memory[], uint8_t densitycode)
+{
+    _memory = memory;
+    _densitycode = densitycode;
+    _size = ((uint32_t)1 << (densitycode + 3)) * 128;
+    _asserted = false;
+    _wel = false;
+    _sleeping = false;
+    _opcode = 0;
+    _position = 0;
+    _addr = 0;
+    _transactions = 0;
+    _bytes = 0;
+    _transfers = 0;
+}
+
+
+
+/*!
+///     @brief   begin()
+///     @return  1: ok
+**/
+boolean FRAM_MB85RS_Simulator::begin()
+{
+    return true;
+}
+
+
+
+/*!
+///     @brief   transfer()
+///              Run a segment list against the simulated chip
+///     @return  1: ok
+**/
+boolean FRAM_MB85RS_Simulator::transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments)
+{
+    _transfers++;
+
+    for (uint8_t i = 0; i < nbSegments; i++)
+    {
+        FRAM_MB85RS_Segment *seg = &segments[i];
+
+        if (!_asserted)
+        {
+            _asserted = true;
+            _transactions++;
+            _opcode = 0;
+            _position = 0;
+        }
+
+        for (size_t k = 0; k < seg->length; k++)
+        {
+            uint8_t value = _clock(seg->tx != NULL ? seg->tx[k] : 0);
+            if (seg->rx != NULL)
+                seg->rx[k] = value;
+        }
+
+        if (seg->csRelease)
+            _release();
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   isBusy()
+///     @return  0: CS released
+///              1: a transaction is open
+**/
+boolean FRAM_MB85RS_Simulator::isBusy()
+{
+    return _asserted;
+}
+
+
+
+/*!
+///     @brief   abort()
+///              CS rising edge, ending the open transaction
+**/
+void FRAM_MB85RS_Simulator::abort()
+{
+    if (_asserted)
+        _release();
+}
+
+
+
+/*!
+///    @brief   isSleeping()
+///    @return  1: the chip is in sleep mode
+**/
+boolean FRAM_MB85RS_Simulator::isSleeping()
+{
+    return _sleeping;
+}
+
+
+
+/*!
+///    @brief   getTransactions()
+///    @return  number of CS assertions
+**/
+uint32_t FRAM_MB85RS_Simulator::getTransactions()
+{
+    return _transactions;
+}
+
+
+
+/*!
+///    @brief   getBytes()
+///    @return  number of bytes clocked
+**/
+uint32_t FRAM_MB85RS_Simulator::getBytes()
+{
+    return _bytes;
+}
+
+
+
+/*!
+///    @brief   getTransfers()
+///    @return  number of segment lists received
+**/
+uint32_t FRAM_MB85RS_Simulator::getTransfers()
+{
+    return _transfers;
+}
+
+
+
+/*!
+///     @brief   _clock()
+///              One byte of the current transaction
+///     @return  the byte on SO
+**/
+uint8_t FRAM_MB85RS_Simulator::_clock(uint8_t value)
+{
+    _bytes++;
+
+    // A sleeping chip only wakes up on the CS falling edge,
+    // the transaction itself is ignored
+    if (_sleeping)
+        return 0;
+
+    if (_opcode == 0 && _position == 0)
+    {
+        _opcode = value;
+        _position = 1;
+        _addr = 0;
+
+        if (_opcode == FRAM_WREN)
+            _wel = true;
+        else if (_opcode == FRAM_WRDI)
+            _wel = false;
+
+        return 0;
+    }
+
+    uint8_t addrBytes = (_densitycode >= DENSITY_MB85RS1MT) ? 3 : 2;
+    uint32_t position = _position++;
+
+    switch (_opcode)
+    {
+        case FRAM_RDID:
+        {
+            const uint8_t id[4] = { FUJITSU_ID, 0x7F, (uint8_t)(0x20 | _densitycode), 0x03 };
+            return (position <= 4) ? id[position - 1] : 0;
+        }
+
+        case FRAM_RDSR:
+            return _wel ? 0x02 : 0x00;
+
+        case FRAM_READ:
+        case FRAM_FSTRD:
+        case FRAM_WRITE:
+            if (position <= addrBytes)
+            {
+                _addr = ((_addr << 8) | value) % _size;
+                return 0;
+            }
+
+            // Dummy byte of the fast read
+            if (_opcode == FRAM_FSTRD && position == addrBytes + 1u)
+                return 0;
+
+            if (_opcode == FRAM_WRITE)
+            {
+                if (_wel)
+                    _memory[_addr] = value;
+                _addr = (_addr + 1) % _size;
+                return 0;
+            }
+            else
+            {
+                uint8_t result = _memory[_addr];
+                _addr = (_addr + 1) % _size;
+                return result;
+            }
+
+        default:
+            return 0;
+    }
+}
+
+
+
+/*!
+///     @brief   _release()
+///              CS rising edge, ends the transaction
+**/
+void FRAM_MB85RS_Simulator::_release()
+{
+    _asserted = false;
+
+    if (_sleeping)
+    {
+        _sleeping = false;
+        return;
+    }
+
+    // The latch is reset once a write completes
+    if ((_opcode == FRAM_WRITE || _opcode == FRAM_WRSR) && _position > 1)
+        _wel = false;
+    else if (_opcode == FRAM_SLEEP)
+        _sleeping = true;
+
+    _opcode = 0;
+    _position = 0;
+}
+
+
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+/*========================================================================*/
+/*                             LINUX SPIDEV                               */
+/*========================================================================*/
+
+// Bytes of one ioctl, bufsiz parameter of the spidev module
+#ifndef FRAM_SPIDEV_BUFSIZ
+    #define FRAM_SPIDEV_BUFSIZ 4096
+#endif
+
+
+/*!
+///     @brief   FRAM_MB85RS_Spidev()
+///              Constructor
+///     @param   device, path of the spidev device, e.g. "/dev/spidev0.0"
+///     @param   speed, SPI clock in Hz
+**/
+FRAM_MB85RS_Spidev::FRAM_MB85RS_Spidev(const char *device, uint32_t speed)
+{
+    _device = device;
+    _speed = speed;
+    _fd = -1;
+    _asserted = false;
+    _ioctls = 0;
+}
+
+
+
+/*!
+///     @brief   ~FRAM_MB85RS_Spidev()
+///              Destructor, closes the device
+**/
+FRAM_MB85RS_Spidev::~FRAM_MB85RS_Spidev()
+{
+    if (_fd >= 0)
+        close(_fd);
+}
+
+
+
+/*!
+///     @brief   begin()
+///              Open the device, mode 0, 8 bits per word
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Spidev::begin()
+{
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+
+    if (_fd < 0)
+        _fd = open(_device, O_RDWR);
+
+    if ( _fd < 0
+        || ioctl(_fd, SPI_IOC_WR_MODE, &mode) < 0
+        || ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0
+        || ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed) < 0 )
+        return false;
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   transfer()
+///              Submit a segment list as one SPI_IOC_MESSAGE. Lists longer
+///              than FRAM_SPIDEV_MAX_SEGMENTS segments or FRAM_SPIDEV_BUFSIZ
+///              bytes are split, CS is held between the ioctls.
+///     @return  0: error
+///              1: ok
+**/
+boolean FRAM_MB85RS_Spidev::transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments)
+{
+    struct spi_ioc_transfer xfer[FRAM_SPIDEV_MAX_SEGMENTS];
+    boolean release[FRAM_SPIDEV_MAX_SEGMENTS];
+    uint8_t count = 0;
+    size_t bytes = 0;
+
+    if (_fd < 0)
+        return false;
+
+    memset(xfer, 0, sizeof(xfer));
+
+    for (uint8_t i = 0; i < nbSegments; i++)
+    {
+        const uint8_t *tx = segments[i].tx;
+        uint8_t *rx = segments[i].rx;
+        size_t left = segments[i].length;
+
+        while (left > 0)
+        {
+            size_t n = FRAM_SPIDEV_BUFSIZ - bytes;
+            if (n > left)
+                n = left;
+
+            xfer[count].tx_buf = (unsigned long)tx;
+            xfer[count].rx_buf = (unsigned long)rx;
+            xfer[count].len = n;
+            xfer[count].speed_hz = _speed;
+            xfer[count].bits_per_word = 8;
+            release[count] = segments[i].csRelease && n == left;
+            count++;
+            bytes += n;
+            left -= n;
+
+            if (tx != NULL)
+                tx += n;
+            if (rx != NULL)
+                rx += n;
+
+            boolean last = (i == nbSegments - 1 && left == 0);
+
+            if (count == FRAM_SPIDEV_MAX_SEGMENTS || bytes == FRAM_SPIDEV_BUFSIZ || last)
+            {
+                // cs_change releases CS between two transfers,
+                // on the last one it keeps CS low after the message
+                for (uint8_t k = 0; k < count; k++)
+                    xfer[k].cs_change = (k < count - 1) ? release[k] : !release[k];
+
+                _ioctls++;
+                if (ioctl(_fd, SPI_IOC_MESSAGE(count), xfer) < 0)
+                {
+                    // The kernel releases CS when a message fails
+                    _asserted = false;
+                    return false;
+                }
+                _asserted = !release[count - 1];
+
+                memset(xfer, 0, sizeof(xfer));
+                count = 0;
+                bytes = 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+
+/*!
+///     @brief   isBusy()
+///     @return  0: CS released
+///              1: the last message kept CS low
+**/
+boolean FRAM_MB85RS_Spidev::isBusy()
+{
+    return _asserted;
+}
+
+
+
+/*!
+///     @brief   abort()
+///              Release CS with an empty message, ending the open transaction
+**/
+void FRAM_MB85RS_Spidev::abort()
+{
+    struct spi_ioc_transfer xfer;
+
+    if (_fd < 0 || !_asserted)
+        return;
+
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.speed_hz = _speed;
+    xfer.bits_per_word = 8;
+
+    _ioctls++;
+    ioctl(_fd, SPI_IOC_MESSAGE(1), &xfer);
+    _asserted = false;
+}
+
+
+
+/*!
+///    @brief   getIoctls()
+///    @return  number of SPI_IOC_MESSAGE calls
+**/
+uint32_t FRAM_MB85RS_Spidev::getIoctls()
+{
+    return _ioctls;
+}
+
+#endif
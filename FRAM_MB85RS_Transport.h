@@ -0,0 +1,198 @@
+/**************************************************************************/
+/*!
+    @file     FRAM_MB85RS_Transport.h
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Bus access for the MB85RS SPI FRAM series. The driver describes each
+    operation as a list of segments and hands it to a transport, up to
+    FRAM_MAX_SEGMENTS segments per call, which clocks it on the bus:
+    - FRAM_MB85RS_ArduinoSPI, hardware SPI of the Arduino cores (default)
+    - FRAM_MB85RS_BitBang, SPI mode 0 on any 4 pins of an Arduino board
+    - FRAM_MB85RS_Simulator, an F-RAM chip in RAM, on any platform
+    - FRAM_MB85RS_Spidev, Linux spidev, one ioctl per segment list
+
+    Outside of the Arduino cores only <stdint.h> and friends are needed.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+#ifndef __FRAM_MB85RS_TRANSPORT_H__
+#define __FRAM_MB85RS_TRANSPORT_H__
+
+#ifdef ARDUINO
+    #include <Arduino.h>
+    #include <SPI.h>
+#else
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <string.h>
+    #include <math.h>
+    #include <time.h>
+
+    typedef bool boolean;
+#endif
+
+
+// Time base of the library, in us: micros() of the Arduino cores, the
+// monotonic clock elsewhere. No global micros() is defined outside of the
+// Arduino cores, it would clash with the GPIO libraries of Linux boards.
+#ifdef ARDUINO
+static inline uint32_t framMicros()
+{
+    return micros();
+}
+#else
+static inline uint32_t framMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+#endif
+
+
+// DEFINES
+
+#ifdef ARDUINO
+    #define SPICONFIG   SPISettings(28000000, MSBFIRST, SPI_MODE0) // SPI frequency (24 MHz max), MODE 0
+#endif
+
+// Pin not connected
+#define FRAM_NO_PIN 0xFF
+
+
+struct FRAM_MB85RS_Segment
+{
+    const uint8_t  *tx;         // Bytes to send, NULL sends 0x00
+    uint8_t        *rx;         // Bytes received, NULL discards them
+    size_t          length;     // Number of bytes, not 0
+    boolean         csRelease;  // CS goes high after this segment, ending the
+                                // transaction. Otherwise CS stays low, even
+                                // after the last segment of the list.
+};
+
+
+class FRAM_MB85RS_Transport
+{
+ public:
+    virtual ~FRAM_MB85RS_Transport() {}
+
+    virtual boolean begin() = 0;
+    virtual boolean transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments) = 0;
+    virtual boolean isBusy();
+    virtual void    abort();
+};
+
+
+#ifdef ARDUINO
+
+class FRAM_MB85RS_ArduinoSPI : public FRAM_MB85RS_Transport
+{
+ public:
+    FRAM_MB85RS_ArduinoSPI(uint8_t cs);
+
+    boolean begin();
+    boolean transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments);
+    boolean isBusy();
+    void    abort();
+
+ private:
+    uint8_t     _cs;            // CS pin
+    boolean     _asserted;      // CS low, transaction open
+};
+
+
+class FRAM_MB85RS_BitBang : public FRAM_MB85RS_Transport
+{
+ public:
+    FRAM_MB85RS_BitBang(uint8_t cs, uint8_t sck, uint8_t mosi, uint8_t miso);
+
+    boolean begin();
+    boolean transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments);
+    boolean isBusy();
+    void    abort();
+
+ private:
+    uint8_t     _cs;            // CS pin
+    uint8_t     _sck;           // Clock pin
+    uint8_t     _mosi;          // Data to the chip
+    uint8_t     _miso;          // Data from the chip
+    boolean     _asserted;      // CS low, transaction open
+
+    uint8_t     _transferByte(uint8_t value);
+};
+
+#endif
+
+
+class FRAM_MB85RS_Simulator : public FRAM_MB85RS_Transport
+{
+ public:
+    FRAM_MB85RS_Simulator(uint8_t memory[], uint8_t densitycode);
+
+    boolean begin();
+    boolean transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments);
+    boolean isBusy();
+    void    abort();
+
+    boolean  isSleeping();
+    uint32_t getTransactions();
+    uint32_t getBytes();
+    uint32_t getTransfers();
+
+ private:
+    uint8_t    *_memory;        // Content of the chip
+    uint8_t     _densitycode;   // DENSITY_MB85RSxxx code returned by RDID
+    uint32_t    _size;          // Bytes of memory
+    boolean     _asserted;      // CS low, transaction open
+    boolean     _wel;           // Write Enable Latch
+    boolean     _sleeping;      // Sleep mode
+    uint8_t     _opcode;        // Opcode of the transaction, 0 before the first byte
+    uint32_t    _position;      // Bytes of the transaction, opcode included
+    uint32_t    _addr;          // Current memory address
+    uint32_t    _transactions;  // CS assertions
+    uint32_t    _bytes;         // Bytes clocked
+    uint32_t    _transfers;     // Calls to transfer()
+
+    uint8_t     _clock(uint8_t value);
+    void        _release();
+};
+
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+// Segments of one ioctl, longer lists are split
+#ifndef FRAM_SPIDEV_MAX_SEGMENTS
+    #define FRAM_SPIDEV_MAX_SEGMENTS 32
+#endif
+
+class FRAM_MB85RS_Spidev : public FRAM_MB85RS_Transport
+{
+ public:
+    FRAM_MB85RS_Spidev(const char *device, uint32_t speed = 20000000);
+    ~FRAM_MB85RS_Spidev();
+
+    boolean begin();
+    boolean transfer(FRAM_MB85RS_Segment segments[], uint8_t nbSegments);
+    boolean isBusy();
+    void    abort();
+
+    uint32_t getIoctls();
+
+ private:
+    const char *_device;        // e.g. "/dev/spidev0.0"
+    uint32_t    _speed;         // SPI clock, in Hz
+    int         _fd;            // -1 while closed
+    boolean     _asserted;      // Last message kept CS low
+    uint32_t    _ioctls;        // SPI_IOC_MESSAGE calls
+};
+
+#endif
+
+
+
+#endif
@@ -0,0 +1,118 @@
+/**************************************************************************/
+/*!
+    @file     DeltaLog_roundtrip.ino
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Round-trip check of a compressed log filled up to its last block.
+    The F-RAM is simulated in RAM (8 KB, MB85RS64V), no chip needed.
+    A second log is stored right after the first one: reads of the full
+    log must stop at its last block and never decode the neighbour.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <SPI.h>
+#include <FRAM_MB85RS_SPI.h>
+#include <FRAM_MB85RS_DeltaLog.h>
+
+
+#define NB_BLOCKS   4
+#define MAX_SAMPLES (NB_BLOCKS * DELTALOG_BLOCK_SIZE)
+
+
+// Simulated chip
+uint8_t memory[8192];
+FRAM_MB85RS_Simulator chip(memory, DENSITY_MB85RS64V);
+FRAM_MB85RS_SPI FRAM(chip);
+
+// The log under test, and its neighbour
+FRAM_MB85RS_DeltaLog samples(FRAM, 0, NB_BLOCKS);
+FRAM_MB85RS_DeltaLog neighbour(FRAM, NB_BLOCKS * DELTALOG_BLOCK_SIZE, NB_BLOCKS);
+
+int32_t reference[MAX_SAMPLES];
+uint32_t nbSamples = 0;
+
+
+
+boolean check(FRAM_MB85RS_DeltaLog &log)
+{
+    int32_t value;
+    uint32_t i;
+
+    if (log.getSampleCount() != nbSamples)
+        return false;
+
+    // Whole log in one pass
+    if (!log.seek(0))
+        return false;
+
+    for (i = 0; log.readNext(&value); i++)
+        if (i >= nbSamples || value != reference[i])
+            return false;
+
+    if (i != nbSamples)
+        return false;
+
+    // Every sample on its own, the last one included
+    for (i = 0; i < nbSamples; i++)
+        if (!log.seek(i) || !log.readNext(&value) || value != reference[i])
+            return false;
+
+    return !log.seek(nbSamples);
+}
+
+
+
+void setup()
+{
+    Serial.begin(115200);
+    while (!Serial) {}  //wait until Serial ready
+
+    Serial.println("Starting...");
+
+    FRAM.init();
+
+    neighbour.format();
+    for (int32_t i = 0; i < 5; i++)
+        neighbour.append(1000 * i);
+    neighbour.flush();
+
+    // Fill the log until append() refuses a sample
+    samples.format();
+    int32_t value = 0;
+
+    while (nbSamples < MAX_SAMPLES)
+    {
+        value += (int32_t)((nbSamples * 37) % 200) - 100;
+        if (!samples.append(value))
+            break;
+        reference[nbSamples++] = value;
+    }
+    samples.flush();
+
+    Serial.print("Samples stored: ");
+    Serial.println(nbSamples);
+
+    if (check(samples))
+        Serial.println("Full log read back : OK");
+    else
+        Serial.println("Full log read back : NOT OK");
+
+    // Same from a log mounted again
+    FRAM_MB85RS_DeltaLog mounted(FRAM, 0, NB_BLOCKS);
+
+    if (mounted.begin() && check(mounted))
+        Serial.println("Full log after begin() : OK");
+    else
+        Serial.println("Full log after begin() : NOT OK");
+}
+
+
+
+void loop()
+{
+}
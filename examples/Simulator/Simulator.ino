@@ -0,0 +1,109 @@
+/**************************************************************************/
+/*!
+    @file     Simulator.ino
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    The driver on a simulated chip: FRAM_MB85RS_Simulator keeps the F-RAM
+    content in RAM (8 KB, MB85RS64V) and counts what goes on the bus.
+    Handy to try the library or an application without a chip, and to
+    see how many transactions each call costs.
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <SPI.h>
+#include <FRAM_MB85RS_SPI.h>
+
+
+// Simulated chip, any DENSITY_MB85RSxxx code with as much RAM
+uint8_t memory[8192];
+FRAM_MB85RS_Simulator chip(memory, DENSITY_MB85RS64V);
+
+// The driver talks to the simulator instead of the SPI bus
+FRAM_MB85RS_SPI FRAM(chip);
+
+
+
+void printBus(const char *operation, uint32_t transactions, uint32_t bytes)
+{
+    Serial.print(operation);
+    Serial.print(": ");
+    Serial.print(chip.getTransactions() - transactions);
+    Serial.print(" transactions, ");
+    Serial.print(chip.getBytes() - bytes);
+    Serial.println(" bytes clocked");
+}
+
+
+
+void setup()
+{
+    Serial.begin(115200);
+    while (!Serial) {}  //wait until Serial ready
+
+    Serial.println("Starting...");
+
+    FRAM.init();
+
+    Serial.print("Simulated chip of ");
+    Serial.print(FRAM.getMaxMemAdr());
+    Serial.println(" bytes");
+
+    uint32_t transactions = chip.getTransactions();
+    uint32_t bytes = chip.getBytes();
+
+//-------- 32-bits value ---------
+    uint32_t writevalue = 0xDEADBEEF;
+    uint32_t readvalue = 0;
+
+    FRAM.write(0x100, writevalue);
+    printBus("write()", transactions, bytes);
+
+    transactions = chip.getTransactions();
+    bytes = chip.getBytes();
+
+    FRAM.read(0x100, &readvalue);
+    printBus("read()", transactions, bytes);
+
+    if (writevalue == readvalue)
+        Serial.println("Write 32-bits test : OK");
+    else
+        Serial.println("Write 32-bits test : NOT OK");
+
+    // The content is plain RAM, little-endian
+    Serial.print("memory[0x100] = 0x");
+    Serial.println(memory[0x100], HEX);
+
+//-------- Gather ---------
+    uint8_t a[4], b[4], c[4];
+    FRAM_MB85RS_Gather requests[] = {
+        { 0x100, 4, a },
+        { 0x106, 4, b },    // 2 bytes apart, read in the same transaction
+        { 0x800, 4, c } };
+
+    transactions = chip.getTransactions();
+    bytes = chip.getBytes();
+
+    Serial.print("gather() READ transactions: ");
+    Serial.println(FRAM.gather(requests, 3));
+    printBus("gather()", transactions, bytes);
+
+//-------- Sleep ---------
+    FRAM.sleep();
+    Serial.print("Chip sleeping: ");
+    Serial.println(chip.isSleeping() ? "yes" : "no");
+
+    FRAM.read(0x100, &readvalue);   // Wakes the chip up
+    Serial.print("Chip sleeping after a read: ");
+    Serial.println(chip.isSleeping() ? "yes" : "no");
+}
+
+
+
+void loop()
+{
+}
@@ -0,0 +1,196 @@
+/**************************************************************************/
+/*!
+    @file     host_test.cpp
+    @author   Christophe Persoz
+    @license  BSD (see license.txt)
+
+    Check of the driver on a plain host, against FRAM_MB85RS_Simulator.
+    Every operation is checked for its result and for the number of CS
+    transactions it costs on the bus.
+
+    Build and run with: make -C extras/host test
+
+    @section  HISTORY
+
+    v0.7 - First release
+*/
+/**************************************************************************/
+
+#include <stdio.h>
+#include <FRAM_MB85RS_SPI.h>
+
+
+static uint8_t memory[131072];
+static FRAM_MB85RS_Simulator chip(memory, DENSITY_MB85RS1MT);
+static FRAM_MB85RS_SPI fram(chip);
+
+static int failures = 0;
+static uint32_t mark = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { printf("FAILED line %d: %s\n", __LINE__, #condition); failures++; } } while (0)
+
+// Transactions since the previous call
+static uint32_t transactions()
+{
+    uint32_t count = chip.getTransactions() - mark;
+    mark = chip.getTransactions();
+    return count;
+}
+
+
+
+static void testReadWrite()
+{
+    uint32_t value = 0;
+    uint8_t buffer[300], check[300];
+
+    CHECK(fram.write(0x1000, (uint32_t)0xDEADBEEF));
+    CHECK(transactions() == 3);                 // WREN, WRITE, WRDI
+
+    CHECK(fram.read(0x1000, &value) && value == 0xDEADBEEF);
+    CHECK(transactions() == 1);
+
+    // Little-endian, address sent MSB first
+    CHECK(memory[0x1000] == 0xEF && memory[0x1003] == 0xDE);
+
+    for (uint16_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = i * 7;
+
+    CHECK(fram.writeArray(0x2000, buffer, sizeof(buffer)));
+    CHECK(transactions() == 3);
+
+    CHECK(fram.readArray(0x2000, check, sizeof(check)));
+    CHECK(transactions() == 1);
+    CHECK(memcmp(buffer, check, sizeof(buffer)) == 0);
+
+    // Out of the memory
+    CHECK(!fram.readArray(fram.getMaxMemAdr() - 2, check, 3));
+    CHECK(transactions() == 0);
+}
+
+
+
+static void testGather()
+{
+    uint8_t a[4], b[4], c[4];
+    FRAM_MB85RS_Gather requests[] = {
+        { 0x2100, 4, c },
+        { 0x2000, 4, a },
+        { 0x2006, 4, b } };     // Gap of 2 bytes, merged with a
+
+    CHECK(fram.gather(requests, 3) == 2);
+    CHECK(transactions() == 2);
+    CHECK(memcmp(a, &memory[0x2000], 4) == 0);
+    CHECK(memcmp(b, &memory[0x2006], 4) == 0);
+    CHECK(memcmp(c, &memory[0x2100], 4) == 0);
+
+    // A gap of opcode + address + FRAM_CS_OVERHEAD bytes costs as much as
+    // a new READ: not merged, one byte less is
+    const uint32_t gap = 1 + 3 + FRAM_CS_OVERHEAD;
+    FRAM_MB85RS_Gather edge[] = {
+        { 0x2000, 4, a },
+        { 0x2004 + gap, 4, b } };
+
+    CHECK(fram.gather(edge, 2) == 2);
+    edge[1].addr--;
+    CHECK(fram.gather(edge, 2) == 1);
+    CHECK(transactions() == 3);
+    CHECK(memcmp(b, &memory[0x2003 + gap], 4) == 0);
+}
+
+
+
+static void testMove()
+{
+    uint8_t expected[300];
+
+    memcpy(expected, &memory[0x2000], sizeof(expected));
+
+    // Overlapping, moved from the end by FRAM_COPY_CHUNK chunks
+    CHECK(fram.move(0x2010, 0x2000, sizeof(expected)));
+    CHECK(transactions() == 4 * ((sizeof(expected) + FRAM_COPY_CHUNK - 1) / FRAM_COPY_CHUNK));
+    CHECK(memcmp(expected, &memory[0x2010], sizeof(expected)) == 0);
+
+    // copy() refuses overlapping ranges
+    CHECK(!fram.copy(0x2000, 0x2010, sizeof(expected)));
+    CHECK(transactions() == 0);
+    CHECK(!fram.copy(0x10, 0xFFFFFFF0, 0x20));
+    CHECK(!fram.copy(0xFFFFFFF0, 0x10, 0x20));
+    CHECK(transactions() == 0);
+
+    CHECK(fram.copy(0x4000, 0x2010, sizeof(expected)));
+    CHECK(memcmp(expected, &memory[0x4000], sizeof(expected)) == 0);
+    transactions();
+}
+
+
+
+static void testStats()
+{
+    int16_t values[100];
+    FRAM_MB85RS_Stats stats;
+
+    for (uint8_t i = 0; i < 100; i++)
+        values[i] = (int16_t)(i * 10 - 300);
+
+    CHECK(fram.writeArray(0x3000, (uint16_t *)values, 100));
+    transactions();
+
+    CHECK(fram.stats(0x3000, 100, FRAM_TYPE_INT16, &stats));
+    CHECK(transactions() == 1);
+    CHECK(stats.count == 100 && stats.min == -300 && stats.max == 690 && stats.sum == 19500);
+}
+
+
+
+static void testSleep()
+{
+    uint8_t value = 0;
+
+    CHECK(fram.write(0x10, (uint8_t)0x5A));
+    transactions();
+
+    CHECK(fram.sleep() && fram.isSleeping() && chip.isSleeping());
+    CHECK(transactions() == 1);                 // SLEEP
+
+    // The access wakes the chip up first: CS pulse, then the READ
+    CHECK(fram.read(0x10, &value) && value == 0x5A);
+    CHECK(transactions() == 2);
+    CHECK(!fram.isSleeping() && !chip.isSleeping());
+    CHECK(fram.getWakeCount() == 1 && fram.getWakeTime() >= FRAM_RECOVERY_US);
+
+    // begin() again on a sleeping chip: wake-up pulse, then RDID
+    CHECK(fram.sleep());
+    transactions();
+    fram.begin();
+    CHECK(!fram.isSleeping() && !chip.isSleeping());
+    CHECK(fram.read(0x10, &value) && value == 0x5A && fram.isReady());
+    CHECK(transactions() == 3);                 // Pulse, RDID, READ
+    CHECK(fram.getMaxMemAdr() == sizeof(memory));
+}
+
+
+
+int main()
+{
+    fram.init();
+
+    CHECK(fram.isReady() && fram.getMaxMemAdr() == sizeof(memory));
+    CHECK(transactions() == 1);                 // RDID
+
+    testReadWrite();
+    testGather();
+    testMove();
+    testStats();
+    testSleep();
+
+    CHECK(!chip.isBusy());
+
+    if (failures)
+        printf("%d check(s) failed\n", failures);
+    else
+        printf("All checks passed\n");
+
+    return failures ? 1 : 0;
+}